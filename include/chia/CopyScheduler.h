@@ -0,0 +1,405 @@
+/*
+ * CopyScheduler.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_COPYSCHEDULER_H_
+#define INCLUDE_CHIA_COPYSCHEDULER_H_
+
+#include <chia/copy.h>
+#include <chia/util.hpp>
+
+#include <set>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <filesystem>
+#else
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#endif
+
+
+/*
+ * Copies final plots to one of many destination directories, in parallel.
+ * A destination is chosen per plot, based on free space, number of active copies
+ * and the average write speed measured so far.
+ */
+class CopyScheduler {
+public:
+	// Retry interval for a destination after a failed copy
+	static constexpr int64_t retry_interval_sec = 300;
+
+	// EMA factor for the write speed
+	static constexpr double speed_alpha = 0.3;
+
+	/*
+	 * dirs = destination directories (with trailing slash)
+	 * max_per_dir = max number of copies to the same directory at once
+	 * limiter = bandwidth limit for all copies (optional)
+	 */
+	CopyScheduler(const std::vector<std::string>& dirs, int max_per_dir = 1, RateLimiter* limiter = nullptr)
+		:	max_per_dir(std::max(max_per_dir, 1)), limiter(limiter)
+	{
+		if(dirs.empty()) {
+			throw std::logic_error("CopyScheduler: no destination");
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		for(const auto& path : dirs) {
+			add_dest(path);
+		}
+	}
+
+	~CopyScheduler() {
+		close();
+	}
+
+	CopyScheduler(CopyScheduler&) = delete;
+	CopyScheduler& operator=(CopyScheduler&) = delete;
+
+	/*
+	 * Adds a file to be copied, returns a job id for wait().
+	 * dir = fixed destination directory (optional), otherwise one is selected.
+	 * Thread-safe.
+	 */
+	uint64_t add(const std::string& src_path, const std::string& file_name, const std::string& dir = std::string())
+	{
+		job_t job;
+		job.src_path = src_path;
+		job.file_name = file_name;
+		job.num_bytes = get_file_size(src_path);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(!dir.empty()) {
+				job.dest = add_dest(dir);
+			}
+			job.id = next_id++;
+			pending.push_back(job);
+		}
+		signal.notify_all();
+		return job.id;
+	}
+
+	// Waits for the given job to finish. Thread-safe.
+	void wait(const uint64_t id)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(is_pending(id)) {
+			signal.wait(lock);
+		}
+	}
+
+	// Waits for all jobs to finish. Thread-safe.
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!pending.empty() || num_active) {
+			signal.wait(lock);
+		}
+	}
+
+	// NOT thread-safe
+	void close()
+	{
+		wait();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			do_run = false;
+		}
+		signal.notify_all();
+		for(auto& thread : threads) {
+			if(thread.joinable()) {
+				thread.join();
+			}
+		}
+		threads.clear();
+	}
+
+private:
+	struct dest_t {
+		std::string path;
+		int num_active = 0;
+		uint64_t num_bytes_active = 0;		// bytes still being copied
+		double speed = 0;					// [bytes/s], 0 = unknown
+		int64_t retry_time = 0;				// [usec] don't use before
+	};
+
+	struct job_t {
+		uint64_t id = 0;
+		int dest = -1;					// fixed destination, -1 = any
+		std::string src_path;
+		std::string file_name;
+		uint64_t num_bytes = 0;
+	};
+
+	static uint64_t get_free_space(const std::string& path)
+	{
+#ifdef _WIN32
+		std::error_code ec;
+		const auto info = std::filesystem::space(path, ec);
+		return ec ? 0 : info.available;
+#else
+		struct statvfs info = {};
+		if(::statvfs(path.c_str(), &info)) {
+			return 0;
+		}
+		return uint64_t(info.f_bavail) * info.f_frsize;
+#endif
+	}
+
+	static uint64_t get_file_size(const std::string& path)
+	{
+#ifdef _WIN32
+		std::error_code ec;
+		const auto size = std::filesystem::file_size(path, ec);
+		return ec ? 0 : size;
+#else
+		struct stat info = {};
+		if(::stat(path.c_str(), &info)) {
+			return 0;
+		}
+		return info.st_size;
+#endif
+	}
+
+	// Returns true if both paths are known to be on the same file system
+	static bool is_same_device(const std::string& path_a, const std::string& path_b)
+	{
+#ifdef _WIN32
+		return false;
+#else
+		struct stat info_a = {};
+		struct stat info_b = {};
+		if(::stat(path_a.c_str(), &info_a) || ::stat(path_b.c_str(), &info_b)) {
+			return false;
+		}
+		return info_a.st_dev == info_b.st_dev;
+#endif
+	}
+
+	// Returns space needed at destination, none if the file can just be renamed there
+	static uint64_t get_num_bytes(const job_t& job, const dest_t& dest)
+	{
+		return is_same_device(job.src_path, dest.path) ? 0 : job.num_bytes;
+	}
+
+	// Returns index of destination, adds it if new (with worker threads)
+	int add_dest(const std::string& path)
+	{
+		for(size_t i = 0; i < dests.size(); ++i) {
+			if(dests[i].path == path) {
+				return i;
+			}
+		}
+		dest_t dest;
+		dest.path = path;
+		dests.push_back(dest);
+		for(int i = 0; i < max_per_dir; ++i) {
+			threads.emplace_back(&CopyScheduler::loop, this);
+		}
+		return dests.size() - 1;
+	}
+
+	bool is_pending(const uint64_t id) const
+	{
+		for(const auto& job : pending) {
+			if(job.id == id) {
+				return true;
+			}
+		}
+		return active.count(id);
+	}
+
+	/*
+	 * Returns best destination for a copy of num_bytes, or -1 if none available right now.
+	 * Prefers idle destinations, then faster ones (unknown speed first), then more free space.
+	 */
+	int select(const job_t& job, const int64_t now) const
+	{
+		if(job.dest >= 0) {
+			const auto& dest = dests[job.dest];
+			return dest.num_active < max_per_dir && now >= dest.retry_time ? job.dest : -1;
+		}
+		int best = -1;
+		uint64_t best_free = 0;
+		for(size_t i = 0; i < dests.size(); ++i)
+		{
+			const auto& dest = dests[i];
+			if(dest.num_active >= max_per_dir || now < dest.retry_time) {
+				continue;
+			}
+			const auto free_space = get_free_space(dest.path);
+			const auto avail = free_space > dest.num_bytes_active ? free_space - dest.num_bytes_active : 0;
+			if(avail < get_num_bytes(job, dest)) {
+				continue;
+			}
+			if(best >= 0) {
+				const auto& curr = dests[best];
+				if(dest.num_active != curr.num_active) {
+					if(dest.num_active > curr.num_active) {
+						continue;
+					}
+				} else if((dest.speed == 0) != (curr.speed == 0)) {
+					if(curr.speed == 0) {
+						continue;
+					}
+				} else if(dest.speed != curr.speed) {
+					if(dest.speed < curr.speed) {
+						continue;
+					}
+				} else if(avail <= best_free) {
+					continue;
+				}
+			}
+			best = i;
+			best_free = avail;
+		}
+		return best;
+	}
+
+	/*
+	 * Returns true if no destination has enough free space for the job, while nothing is being
+	 * copied there either and none is waiting to be retried, so the job would stay pending forever.
+	 * Jobs with a fixed destination are never unplaceable, they are retried until they succeed.
+	 */
+	bool is_unplaceable(const job_t& job, const int64_t now) const
+	{
+		if(job.dest >= 0) {
+			return false;
+		}
+		for(const auto& dest : dests) {
+			if(dest.num_active || now < dest.retry_time || get_free_space(dest.path) >= get_num_bytes(job, dest)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Drops pending jobs which cannot be copied anywhere, the files stay where they are.
+	void drop_unplaceable()
+	{
+		const auto now = get_wall_time_micros();
+		for(auto iter = pending.begin(); iter != pending.end();) {
+			if(is_unplaceable(*iter, now)) {
+				std::cout << "No final directory has enough space for " << iter->file_name
+						<< ", leaving it at " << iter->src_path << std::endl;
+				iter = pending.erase(iter);
+				signal.notify_all();
+			} else {
+				iter++;
+			}
+		}
+	}
+
+	void loop()
+	{
+#ifdef _GNU_SOURCE
+		pthread_setname_np(pthread_self(), "final/copy");
+#endif
+		std::unique_lock<std::mutex> lock(mutex);
+		while(true)
+		{
+			int index = -1;
+			auto iter = pending.begin();
+			for(; iter != pending.end(); ++iter) {
+				index = select(*iter, get_wall_time_micros());
+				if(index >= 0) {
+					break;
+				}
+			}
+			if(index < 0) {
+				if(!do_run) {
+					break;
+				}
+				drop_unplaceable();
+				if(pending.empty()) {
+					signal.wait(lock);
+				} else {
+					// wait for a copy to finish, or for free space / retry time
+					signal.wait_for(lock, std::chrono::seconds(10));
+				}
+				continue;
+			}
+			const auto job = *iter;
+			pending.erase(iter);
+			active.insert(job.id);
+			num_active++;
+
+			const auto num_bytes = get_num_bytes(job, dests[index]);
+			{
+				auto& dest = dests[index];
+				dest.num_active++;
+				dest.num_bytes_active += num_bytes;
+			}
+			const auto dst_path = dests[index].path + job.file_name;
+			lock.unlock();
+
+			std::cout << "Started copy to " << dst_path << std::endl;
+
+			bool success = false;
+			double speed = 0;
+			const auto time_begin = get_wall_time_micros();
+			try {
+				const auto bytes = final_copy(job.src_path, dst_path, limiter);
+
+				const auto time = (get_wall_time_micros() - time_begin) / 1e6;
+				if(time > 1) {
+					speed = bytes / time;
+					std::cout << "Copy to " << dst_path << " finished, took " << time << " sec, "
+						<< (bytes / time / 1e6) << " MB/s avg." << std::endl;
+				} else {
+					std::cout << "Renamed final plot to " << dst_path << std::endl;
+				}
+				success = true;
+			} catch(const std::exception& ex) {
+				std::cout << "Copy to " << dst_path << " failed with: " << ex.what() << std::endl;
+				// remove partial copy, unless the source is gone (moved already)
+				if(get_file_size(job.src_path)) {
+					std::remove((dst_path + ".tmp").c_str());
+				}
+			}
+
+			lock.lock();
+			auto& dest = dests[index];		// dests might have grown meanwhile
+			dest.num_active--;
+			dest.num_bytes_active -= num_bytes;
+			if(speed > 0) {
+				dest.speed = dest.speed > 0 ? speed_alpha * speed + (1 - speed_alpha) * dest.speed : speed;
+			}
+			if(!success) {
+				dest.retry_time = get_wall_time_micros() + retry_interval_sec * 1000000;
+				pending.push_front(job);	// try again, with another destination if possible
+			}
+			active.erase(job.id);
+			num_active--;
+			signal.notify_all();
+		}
+	}
+
+private:
+	const int max_per_dir;
+	RateLimiter* const limiter;
+
+	bool do_run = true;
+	uint64_t next_id = 0;
+	size_t num_active = 0;
+	std::vector<dest_t> dests;
+	std::list<job_t> pending;
+	std::set<uint64_t> active;
+
+	std::mutex mutex;
+	std::condition_variable signal;
+	std::vector<std::thread> threads;
+
+};
+
+
+#endif /* INCLUDE_CHIA_COPYSCHEDULER_H_ */
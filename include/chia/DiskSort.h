@@ -9,27 +9,124 @@
 #define INCLUDE_CHIA_DISKSORT_H_
 
 #include <chia/buffer.h>
+#include <chia/bitpack.h>
+#include <chia/MappedFile.h>
 #include <chia/ThreadPool.h>
+#include <chia/util.hpp>
 
+#include <deque>
 #include <vector>
 #include <string>
 #include <cstdio>
 #include <cstddef>
 #include <memory>
+#include <atomic>
+#include <iostream>
+#include <algorithm>
 #include <functional>
 
 
+/*
+ * Bit-packed format for bucket files, used with g_bit_pack.
+ * The top bits of the key are implied by the bucket and not stored.
+ * To enable for an entry type, specialize with:
+ * 	static constexpr bool enabled = true;
+ * 	static int get_bits(int key_size, int key_bits);		// bits per entry
+ * 	static void pack(const T& entry, bit_writer_t& out, int key_size, int key_bits);
+ * 	static void unpack(T& entry, bit_reader_t& in, int key_size, int key_bits, uint64_t key_prefix);
+ * key_bits = number of low key bits to store, key_prefix = implied key bits.
+ */
+template<typename T, typename Key>
+struct bucket_codec {
+	static constexpr bool enabled = false;
+};
+
+// Returns g_memory_budget, or half of physical memory by default
+inline
+uint64_t get_memory_budget() {
+	return g_memory_budget ? g_memory_budget : get_total_memory() / 2;
+}
+
+// Max memory for one bucket in DiskSort::read(), when num_threads_read are reading at once
+inline
+uint64_t get_max_bucket_size(int num_threads_read) {
+	return get_memory_budget() / 2 / (num_threads_read + 2);
+}
+
+/*
+ * Chooses the number of buckets (log2) for a sort of about 2^k entries of type T,
+ * unless log_num_buckets > 0 (fixed by user).
+ * Picks as few buckets as possible (larger I/O, less open files), as long as the buckets
+ * being read at once fit into half the memory budget and a bucket split (the unit of sorting)
+ * still fits into cache.
+ */
+template<typename T>
+int get_log_num_buckets(int log_num_buckets, int k, int num_threads, const std::string& name)
+{
+	if(log_num_buckets > 0) {
+		return log_num_buckets;
+	}
+	static constexpr int min_log = 4;
+	static constexpr uint64_t max_split_size = uint64_t(4) << 20;
+	
+	const int max_log = std::max(std::min(10, k / 2), min_log);
+	const uint64_t max_bucket_size = get_max_bucket_size(std::max(num_threads / 2, 2));
+	const uint64_t num_entries = uint64_t(1) << k;
+	
+	int log = min_log;
+	for(; log < max_log; ++log) {
+		const uint64_t bucket_size = (num_entries >> log) * sizeof(T);
+		const uint64_t split_size = bucket_size >> log;
+		if(bucket_size <= max_bucket_size && split_size <= max_split_size) {
+			break;
+		}
+	}
+	std::cout << name << " sort uses 2^" << log << " buckets (auto)" << std::endl;
+	return log;
+}
+
 template<typename T, typename Key>
 class DiskSort {
 private:
+	// A bucket, or a part of it after splitting (see split_bucket())
+	struct part_t {
+		size_t index = 0;			// bucket index
+		uint64_t offset = 0;
+		size_t num_entries = 0;
+		int sub_log = 0;			// log2 of number of parts
+		std::string file_name;		// empty = bucket file itself
+	};
+	
+	// Header of a bucket file which was written back sorted, see set_keep_sorted()
+	struct sorted_header_t {
+		uint64_t magic = 0;
+		uint64_t num_entries = 0;
+	};
+	static constexpr uint64_t sorted_magic = 0x444554524f534b44;	// "DKSORTED"
+	
+	/*
+	 * Writers reserve space at the end of the file (tail) and write into it without locking,
+	 * num_entries is known after finish().
+	 */
 	struct bucket_t {
 		FILE* file = nullptr;
-		std::mutex mutex;
+		int fd = -1;						// for writing
+		std::mutex mutex;					// only used without pwrite()
 		std::string file_name;
 		size_t num_entries = 0;
+		std::atomic<uint64_t> tail {0};			// in bytes
+		std::atomic<size_t> num_packed {0};		// entries written via write_packed()
+		bool is_sorted = false;					// sorted_header_t + raw entries in order
 		
 		void open(const char* mode);
+		bool check_sorted();
+		void create();
 		void write(const void* data, size_t count);
+		void write_packed(const uint64_t* data, size_t num_words, size_t count);
+		void write_at(uint64_t offset, const void* data, size_t num_bytes);
+		void finish(int packed_bits);
+		size_t count_packed(int num_bits);
+		void prefetch();
 		void close();
 		void remove();
 	};
@@ -47,6 +144,64 @@ public:
 		std::vector<write_buffer_t<T>> buckets;
 	};
 	
+	typedef std::pair<std::vector<T>, size_t> block_t;
+	
+	/*
+	 * Pull-based sorted output, see blocks().
+	 * read() runs in the background, at most max_ahead sorted blocks are buffered.
+	 */
+	class BlockReader : public Processor<block_t> {
+	public:
+		class iterator {
+		public:
+			iterator(BlockReader* reader = nullptr) : reader(reader) { ++(*this); }
+			block_t& operator*() { return block; }
+			iterator& operator++() {
+				if(reader && !reader->next(block)) {
+					reader = nullptr;
+				}
+				return *this;
+			}
+			bool operator!=(const iterator& other) const { return reader != other.reader; }
+		private:
+			BlockReader* reader = nullptr;
+			block_t block;
+		};
+		
+		BlockReader(DiskSort* disk, int num_threads, bool spill);
+		~BlockReader();
+		
+		BlockReader(BlockReader&) = delete;
+		BlockReader& operator=(BlockReader&) = delete;
+		
+		// Returns false at the end [NOT thread-safe]
+		bool next(block_t& block);
+		
+		// called by read()
+		void take(block_t& block) override;
+		
+		iterator begin() { return iterator(this); }
+		iterator end() { return iterator(); }
+		
+	private:
+		void run(int num_threads);
+		void push(block_t& block);
+		
+	private:
+		DiskSort* disk = nullptr;
+		const size_t max_ahead = 0;
+		FILE* spill_file = nullptr;
+		std::vector<size_t> spill_blocks;
+		
+		bool do_run = true;
+		bool is_done = false;
+		std::string ex_what;
+		std::deque<block_t> queue;
+		std::mutex mutex;
+		std::condition_variable signal;
+		std::shared_ptr<ThreadCache::Job> job;
+	};
+	
 	DiskSort(	int key_size, int log_num_buckets,
 				std::string file_prefix, bool read_only = false);
 	
@@ -60,6 +215,16 @@ public:
 	void read(	Processor<std::pair<std::vector<T>, size_t>>* output,
 				int num_threads, int num_threads_read = -1);
 	
+	/*
+	 * Sorted output in order, for use in a range based for loop:
+	 * 	for(auto& block : sort.blocks(num_threads)) { ... }
+	 * With spill = true the sorted entries are also written to a file, so that
+	 * following calls to blocks() read them back without sorting again.
+	 */
+	BlockReader blocks(int num_threads, bool spill = false) {
+		return BlockReader(this, num_threads, spill);
+	}
+	
 	void finish();
 	
 	void close();
@@ -79,19 +244,81 @@ public:
 		keep_files = enable;
 	}
 	
+	/*
+	 * Write buckets back in sorted order during read(), so that following reads
+	 * (also via read_only) are a sequential stream without sorting. Keeps the files.
+	 */
+	void set_keep_sorted(bool enable) {
+		keep_sorted = enable;
+	}
+	
 private:
-	void read_bucket(	std::pair<size_t, size_t>& index,
+	// Writes sorted blocks to temporary bucket files, then passes them on to output
+	class SortedWriter : public Processor<block_t> {
+	public:
+		SortedWriter(DiskSort* disk, Processor<block_t>* output);
+		~SortedWriter();
+		
+		SortedWriter(SortedWriter&) = delete;
+		SortedWriter& operator=(SortedWriter&) = delete;
+		
+		void take(block_t& block) override;
+		
+		// replaces the bucket files, after all blocks have been written
+		void commit();
+		
+	private:
+		void open_bucket();
+		void finish_bucket();
+		
+	private:
+		DiskSort* disk = nullptr;
+		Processor<block_t>* output = nullptr;
+		size_t index = 0;
+		size_t count = 0;
+		FILE* file = nullptr;
+		bool is_commit = false;
+		std::vector<uint8_t> buffer;
+	};
+	
+	void read_sorted(Processor<block_t>* output);
+	
+	void read_bucket(	part_t& part,
 						std::vector<std::pair<std::vector<T>, size_t>>& out,
 						read_buffer_t<T>& buffer);
 	
+	std::vector<part_t> split_bucket(size_t index, int sub_log, read_buffer_t<T>& buffer);
+	
+	template<typename F>
+	void read_entries(size_t index, read_buffer_t<T>& buffer, const F& func);
+	
+	template<typename F>
+	void read_raw(	FILE* file, const MappedFile* map, const std::string& file_name,
+					size_t num_entries, read_buffer_t<T>& buffer, const F& func);
+	
+	void write_packed(size_t index, const void* data, size_t count);
+	
+	template<typename F>
+	void read_packed(bucket_t& bucket, const MappedFile* map, size_t index, const F& func);
+	
+	static int get_packed_bits(int key_size, int log_num_buckets);
+	
+	static void sort_block(std::vector<T>& block);
+	
 private:
 	const int key_size = 0;
 	const int log_num_buckets = 0;
 	const int bucket_key_shift = 0;
+	const int packed_bits = 0;				// bits per entry if packed, otherwise 0
 	
 	bool keep_files = false;
+	bool keep_sorted = false;
 	bool is_finished = false;
 	
+	std::string spill_file_name;			// see blocks()
+	std::vector<size_t> spill_blocks;		// block sizes in spill file, empty = no spill
+	std::atomic<bool> do_abort {false};		// set by ~BlockReader() to stop read() early
+	
 	WriteCache cache;
 	std::vector<bucket_t> buckets;
 	
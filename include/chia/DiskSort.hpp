@@ -12,9 +12,16 @@
 #include <chia/util.hpp>
 
 #include <map>
+#include <utility>
+#include <cstdint>
 #include <algorithm>
 #include <unordered_map>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 template<typename T, typename Key>
 void DiskSort<T, Key>::bucket_t::open(const char* mode)
@@ -28,16 +35,120 @@ void DiskSort<T, Key>::bucket_t::open(const char* mode)
 	}
 }
 
+// Returns true (and sets num_entries) if the file was written back sorted
+template<typename T, typename Key>
+bool DiskSort<T, Key>::bucket_t::check_sorted()
+{
+	FILE* tmp = fopen(file_name.c_str(), "rb");
+	if(!tmp) {
+		return false;
+	}
+	sorted_header_t header;
+	const bool have_header = fread(&header, sizeof(header), 1, tmp) == 1;
+	fclose(tmp);
+	if(have_header && header.magic == sorted_magic
+		&& uint64_t(get_file_size(file_name.c_str())) == sizeof(header) + header.num_entries * T::disk_size)
+	{
+		num_entries = header.num_entries;
+		is_sorted = true;
+	}
+	return is_sorted;
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::bucket_t::create()
+{
+#ifdef _WIN32
+	open("wb");
+#else
+	fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		throw std::runtime_error("open() failed with: " + std::string(std::strerror(errno)));
+	}
+#endif
+}
+
+// thread safe
 template<typename T, typename Key>
 void DiskSort<T, Key>::bucket_t::write(const void* data, size_t count)
 {
+	const size_t num_bytes = count * T::disk_size;
+	write_at(tail.fetch_add(num_bytes), data, num_bytes);
+}
+
+// thread safe
+template<typename T, typename Key>
+void DiskSort<T, Key>::bucket_t::write_packed(const uint64_t* data, size_t num_words, size_t count)
+{
+	const uint32_t header = count;
+	const size_t num_bytes = num_words * sizeof(uint64_t);
+	const uint64_t offset = tail.fetch_add(sizeof(header) + num_bytes);
+	write_at(offset, &header, sizeof(header));
+	write_at(offset + sizeof(header), data, num_bytes);
+	num_packed += count;
+}
+
+// Writes to space reserved via tail [thread safe]
+template<typename T, typename Key>
+void DiskSort<T, Key>::bucket_t::write_at(uint64_t offset, const void* data, size_t num_bytes)
+{
+#ifdef _WIN32
 	std::lock_guard<std::mutex> lock(mutex);
 	if(file) {
-		if(fwrite(data, T::disk_size, count, file) != count) {
+		if(_fseeki64(file, offset, SEEK_SET) || fwrite(data, 1, num_bytes, file) != num_bytes) {
 			throw std::runtime_error("fwrite() failed with: " + std::string(std::strerror(errno)));
 		}
-		num_entries += count;
 	}
+#else
+	const auto* src = static_cast<const uint8_t*>(data);
+	while(fd >= 0 && num_bytes) {
+		const auto ret = ::pwrite(fd, src, num_bytes, offset);
+		if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error("pwrite() failed with: " + std::string(std::strerror(errno)));
+		}
+		src += ret;
+		offset += ret;
+		num_bytes -= ret;
+	}
+#endif
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::bucket_t::finish(int packed_bits)
+{
+	close();
+	num_entries = packed_bits ? num_packed.load() : tail / T::disk_size;
+}
+
+template<typename T, typename Key>
+size_t DiskSort<T, Key>::bucket_t::count_packed(int num_bits)
+{
+	open("rb");
+	size_t count = 0;
+	uint32_t header = 0;
+	while(fread(&header, sizeof(header), 1, file) == 1) {
+		if(fseek(file, bit_words(size_t(header) * num_bits) * sizeof(uint64_t), SEEK_CUR)) {
+			throw std::runtime_error("fseek() failed with: " + std::string(std::strerror(errno)));
+		}
+		count += header;
+	}
+	close();
+	return count;
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::bucket_t::prefetch()
+{
+#ifndef _WIN32
+	const int fd = ::open(file_name.c_str(), O_RDONLY);
+	if(fd >= 0) {
+		::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);		// starts async read into page cache
+		::close(fd);
+	}
+#endif
 }
 
 template<typename T, typename Key>
@@ -49,6 +160,14 @@ void DiskSort<T, Key>::bucket_t::close()
 		}
 		file = nullptr;
 	}
+#ifndef _WIN32
+	if(fd >= 0) {
+		if(::close(fd)) {
+			throw std::runtime_error("close() failed with: " + std::string(std::strerror(errno)));
+		}
+		fd = -1;
+	}
+#endif
 }
 
 template<typename T, typename Key>
@@ -99,8 +218,10 @@ DiskSort<T, Key>::DiskSort(	int key_size, int log_num_buckets,
 	:	key_size(key_size),
 		log_num_buckets(log_num_buckets),
 		bucket_key_shift(key_size - log_num_buckets),
+		packed_bits(get_packed_bits(key_size, log_num_buckets)),
 		keep_files(read_only),
 		is_finished(read_only),
+		spill_file_name(file_prefix + ".sorted.tmp"),
 		cache(this, key_size - log_num_buckets, 1 << log_num_buckets),
 		buckets(1 << log_num_buckets)
 {
@@ -108,9 +229,16 @@ DiskSort<T, Key>::DiskSort(	int key_size, int log_num_buckets,
 		auto& bucket = buckets[i];
 		bucket.file_name = file_prefix + ".sort_bucket_" + std::to_string(i) + ".tmp";
 		if(read_only) {
-			bucket.num_entries = get_file_size(bucket.file_name.c_str()) / T::disk_size;
+			if(bucket.check_sorted()) {
+				continue;
+			}
+			if(packed_bits) {
+				bucket.num_entries = bucket.count_packed(packed_bits);
+			} else {
+				bucket.num_entries = get_file_size(bucket.file_name.c_str()) / T::disk_size;
+			}
 		} else {
-			bucket.open("wb");
+			bucket.create();
 		}
 	}
 }
@@ -130,7 +258,127 @@ void DiskSort<T, Key>::write(size_t index, const void* data, size_t count)
 	if(index >= buckets.size()) {
 		throw std::logic_error("bucket index out of range");
 	}
-	buckets[index].write(data, count);
+	if(packed_bits) {
+		write_packed(index, data, count);
+	} else {
+		buckets[index].write(data, count);
+	}
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::write_packed(size_t index, const void* data, size_t count)
+{
+	typedef bucket_codec<T, Key> codec_t;
+	if constexpr(codec_t::enabled) {
+		thread_local std::vector<uint64_t> buffer;
+		const size_t num_words = bit_words(count * packed_bits);
+		buffer.resize(num_words);
+		
+		bit_writer_t out(buffer.data());
+		const auto* src = static_cast<const uint8_t*>(data);
+		for(size_t i = 0; i < count; ++i) {
+			T entry;
+			entry.read(src + i * T::disk_size);
+			codec_t::pack(entry, out, key_size, bucket_key_shift);
+		}
+		buckets[index].write_packed(buffer.data(), num_words, count);
+	}
+}
+
+template<typename T, typename Key>
+int DiskSort<T, Key>::get_packed_bits(int key_size, int log_num_buckets)
+{
+	typedef bucket_codec<T, Key> codec_t;
+	if constexpr(codec_t::enabled) {
+		if(g_bit_pack) {
+			return codec_t::get_bits(key_size, key_size - log_num_buckets);
+		}
+	}
+	return 0;
+}
+
+// LSD radix sort of keys < 2^num_bits, tmp = scratch space
+inline
+void radix_sort(std::vector<uint64_t>& keys, std::vector<uint64_t>& tmp, const int num_bits)
+{
+	static constexpr int digit_bits = 11;
+	static constexpr uint64_t digit_mask = (uint64_t(1) << digit_bits) - 1;
+	
+	if(keys.size() < 256) {
+		std::sort(keys.begin(), keys.end());
+		return;
+	}
+	tmp.resize(keys.size());
+	for(int shift = 0; shift < num_bits; shift += digit_bits)
+	{
+		size_t count[digit_mask + 2] = {};
+		for(const auto key : keys) {
+			count[((key >> shift) & digit_mask) + 1]++;
+		}
+		for(size_t i = 1; i < digit_mask + 2; ++i) {
+			count[i] += count[i - 1];
+		}
+		for(const auto key : keys) {
+			tmp[count[(key >> shift) & digit_mask]++] = key;
+		}
+		keys.swap(tmp);
+	}
+}
+
+/*
+ * Entries wider than 8 bytes are sorted indirectly if possible: (key - min, index) is packed
+ * into 64 bits and radix sorted, then the entries are gathered once, instead of moving whole
+ * entries on every swap. Equal keys keep their order.
+ */
+template<typename T, typename Key>
+void DiskSort<T, Key>::sort_block(std::vector<T>& block)
+{
+	typedef decltype(Key{}(std::declval<const T&>())) key_t;
+	
+	const size_t count = block.size();
+	if constexpr(sizeof(T) > sizeof(uint64_t)) {
+		if(count > 1 && count <= UINT32_MAX) {
+			key_t min = Key{}(block[0]);
+			key_t max = min;
+			for(const auto& entry : block) {
+				const key_t key = Key{}(entry);
+				min = std::min(min, key);
+				max = std::max(max, key);
+			}
+			int index_bits = 1;
+			while((size_t(1) << index_bits) < count) {
+				index_bits++;
+			}
+			// range_bits = 64 means at least 64 bits (full range), never fits with the index
+			const key_t range = max - min;
+			int range_bits = 0;
+			while(range_bits < 64 && (range >> range_bits) != 0) {
+				range_bits++;
+			}
+			if(range_bits < 64 && range_bits + index_bits <= 64) {
+				// not thread_local, sort threads are pooled and would hold on to it
+				std::vector<uint64_t> keys(count);
+				std::vector<uint64_t> tmp;
+				for(size_t i = 0; i < count; ++i) {
+					keys[i] = (uint64_t(Key{}(block[i]) - min) << index_bits) | i;
+				}
+				radix_sort(keys, tmp, range_bits + index_bits);
+				
+				const uint64_t index_mask = (uint64_t(1) << index_bits) - 1;
+				std::vector<T> out;
+				out.reserve(count);
+				for(const auto key : keys) {
+					out.push_back(block[key & index_mask]);
+				}
+				block = std::move(out);
+				return;
+			}
+		}
+	}
+	std::sort(block.begin(), block.end(),
+		[](const T& lhs, const T& rhs) -> bool {
+			return Key{}(lhs) < Key{}(rhs);
+		});
 }
 
 template<typename T, typename Key>
@@ -146,16 +394,27 @@ void DiskSort<T, Key>::read(Processor<std::pair<std::vector<T>, size_t>>* output
 	if(num_threads_read < 0) {
 		num_threads_read = std::max(num_threads / 2, 2);
 	}
+	const auto num_sorted = std::count_if(buckets.begin(), buckets.end(),
+			[](const bucket_t& bucket) -> bool { return bucket.is_sorted; });
+	if(num_sorted) {
+		if(size_t(num_sorted) < buckets.size()) {
+			throw std::logic_error("DiskSort: partially sorted buckets");
+		}
+		read_sorted(output);
+		return;
+	}
+	
+	std::unique_ptr<SortedWriter> writer;
+	if(keep_sorted) {
+		writer = std::make_unique<SortedWriter>(this, output);
+	}
 	
 	ThreadPool<	std::pair<std::vector<T>, size_t>,
 				std::pair<std::vector<T>, size_t>> sort_pool(
 		[](std::pair<std::vector<T>, size_t>& input, std::pair<std::vector<T>, size_t>& out, size_t&) {
-			std::sort(input.first.begin(), input.first.end(),
-				[](const T& lhs, const T& rhs) -> bool {
-					return Key{}(lhs) < Key{}(rhs);
-				});
+			sort_block(input.first);
 			out = std::move(input);
-		}, output, num_threads, "Disk/sort");
+		}, writer ? writer.get() : output, num_threads, "Disk/sort");
 	
 	Thread<std::vector<std::pair<std::vector<T>, size_t>>> sort_thread(
 		[&sort_pool](std::vector<std::pair<std::vector<T>, size_t>>& input) {
@@ -164,58 +423,246 @@ void DiskSort<T, Key>::read(Processor<std::pair<std::vector<T>, size_t>>* output
 			}
 		}, "Disk/sort");
 	
-	ThreadPool<	std::pair<size_t, size_t>,
+	ThreadPool<	part_t,
 				std::vector<std::pair<std::vector<T>, size_t>>,
 				read_buffer_t<T>> read_pool(
 		std::bind(&DiskSort::read_bucket, this,
 				std::placeholders::_1, std::placeholders::_2, std::placeholders::_3),
 		&sort_thread, num_threads_read, "Disk/read");
 	
-	uint64_t offset = 0;
+	std::vector<uint64_t> file_size(buckets.size());
 	for(size_t i = 0; i < buckets.size(); ++i) {
-		read_pool.take_copy(std::make_pair(i, offset));
-		offset += buckets[i].num_entries;
+		file_size[i] = std::max<int64_t>(get_file_size(buckets[i].file_name.c_str()), 0);
+	}
+	// keep the next buckets in flight, within a quarter of the memory budget
+	const uint64_t max_read_ahead = get_memory_budget() / 4;
+	uint64_t read_ahead = 0;			// bytes in [i, prefetch_end)
+	size_t prefetch_end = 0;
+	
+	// buckets which do not fit into memory are split into parts first
+	const uint64_t max_bucket_size = get_max_bucket_size(num_threads_read);
+	const int max_sub_log = std::min(log_num_buckets, 8);
+	std::unique_ptr<read_buffer_t<T>> split_buffer;
+	
+	uint64_t offset = 0;
+	for(size_t i = 0; i < buckets.size() && !do_abort; ++i) {
+		while(prefetch_end < buckets.size()
+			&& (prefetch_end <= i || read_ahead + file_size[prefetch_end] <= max_read_ahead))
+		{
+			buckets[prefetch_end].prefetch();
+			read_ahead += file_size[prefetch_end++];
+		}
+		const uint64_t bucket_size = buckets[i].num_entries * sizeof(T);
+		if(bucket_size > max_bucket_size && max_sub_log > 0)
+		{
+			int sub_log = 1;
+			while(sub_log < max_sub_log && (bucket_size >> sub_log) > max_bucket_size) {
+				sub_log++;
+			}
+			if(!split_buffer) {
+				split_buffer = std::make_unique<read_buffer_t<T>>();
+			}
+			for(auto& part : split_bucket(i, sub_log, *split_buffer)) {
+				part.offset = offset;
+				offset += part.num_entries;
+				read_pool.take(part);
+			}
+		} else {
+			part_t part;
+			part.index = i;
+			part.offset = offset;
+			part.num_entries = buckets[i].num_entries;
+			offset += part.num_entries;
+			read_pool.take(part);
+		}
+		read_ahead -= file_size[i];
 	}
 	read_pool.close();
 	sort_thread.close();
 	sort_pool.close();
+	
+	if(writer && !do_abort) {
+		writer->commit();
+	}
+}
+
+// Reads buckets which were written back sorted, see set_keep_sorted()
+template<typename T, typename Key>
+void DiskSort<T, Key>::read_sorted(Processor<block_t>* output)
+{
+	read_buffer_t<T> buffer;
+	uint64_t offset = 0;
+	for(size_t i = 0; i < buckets.size() && !do_abort; ++i)
+	{
+		auto& bucket = buckets[i];
+		if(i + 1 < buckets.size()) {
+			buckets[i + 1].prefetch();
+		}
+		bucket.open("rb");
+		if(fseek(bucket.file, sizeof(sorted_header_t), SEEK_SET)) {
+			throw std::runtime_error("fseek() failed with: " + std::string(std::strerror(errno)));
+		}
+		for(size_t k = 0; k < bucket.num_entries;)
+		{
+			const size_t count = std::min(buffer.capacity, bucket.num_entries - k);
+			if(fread(buffer.data, T::disk_size, count, bucket.file) != count) {
+				throw std::runtime_error("fread() failed with: " + std::string(std::strerror(errno)));
+			}
+			block_t block;
+			block.first.resize(count);
+			for(size_t j = 0; j < count; ++j) {
+				block.first[j].read(buffer.entry_at(j));
+			}
+			block.second = offset;
+			offset += count;
+			k += count;
+			output->take(block);
+		}
+		bucket.close();
+		if(!keep_files && !keep_sorted) {
+			bucket.remove();
+		}
+	}
+}
+
+template<typename T, typename Key>
+DiskSort<T, Key>::SortedWriter::SortedWriter(DiskSort* disk, Processor<block_t>* output)
+	:	disk(disk), output(output)
+{
+}
+
+template<typename T, typename Key>
+DiskSort<T, Key>::SortedWriter::~SortedWriter()
+{
+	if(file) {
+		fclose(file);
+	}
+	if(!is_commit) {
+		for(size_t i = 0; i <= index && i < disk->buckets.size(); ++i) {
+			std::remove((disk->buckets[i].file_name + ".sorted").c_str());
+		}
+	}
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::SortedWriter::take(block_t& block)
+{
+	const auto& buckets = disk->buckets;
+	while(index < buckets.size() && count == buckets[index].num_entries) {
+		finish_bucket();
+	}
+	if(index >= buckets.size() || count + block.first.size() > buckets[index].num_entries) {
+		throw std::logic_error("SortedWriter: block exceeds bucket");
+	}
+	if(!file) {
+		open_bucket();
+	}
+	buffer.resize(block.first.size() * T::disk_size);
+	for(size_t i = 0; i < block.first.size(); ++i) {
+		block.first[i].write(buffer.data() + i * T::disk_size);
+	}
+	if(fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+		throw std::runtime_error("fwrite() failed with: " + std::string(std::strerror(errno)));
+	}
+	count += block.first.size();
+	
+	if(output) {
+		output->take(block);
+	}
 }
 
 template<typename T, typename Key>
-void DiskSort<T, Key>::read_bucket(	std::pair<size_t, size_t>& index,
+void DiskSort<T, Key>::SortedWriter::open_bucket()
+{
+	const auto& bucket = disk->buckets[index];
+	file = fopen((bucket.file_name + ".sorted").c_str(), "wb");
+	if(!file) {
+		throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)));
+	}
+	sorted_header_t header;
+	header.magic = sorted_magic;
+	header.num_entries = bucket.num_entries;
+	if(fwrite(&header, sizeof(header), 1, file) != 1) {
+		throw std::runtime_error("fwrite() failed with: " + std::string(std::strerror(errno)));
+	}
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::SortedWriter::finish_bucket()
+{
+	if(!file) {
+		open_bucket();		// empty bucket, header only
+	}
+	if(fclose(file)) {
+		file = nullptr;
+		throw std::runtime_error("fclose() failed with: " + std::string(std::strerror(errno)));
+	}
+	file = nullptr;
+	count = 0;
+	index++;
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::SortedWriter::commit()
+{
+	auto& buckets = disk->buckets;
+	while(index < buckets.size()) {
+		finish_bucket();
+	}
+	for(auto& bucket : buckets) {
+		std::remove(bucket.file_name.c_str());
+		if(std::rename((bucket.file_name + ".sorted").c_str(), bucket.file_name.c_str())) {
+			throw std::runtime_error("rename() failed with: " + std::string(std::strerror(errno)));
+		}
+		bucket.is_sorted = true;
+	}
+	is_commit = true;
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::read_bucket(	part_t& part,
 									std::vector<std::pair<std::vector<T>, size_t>>& out,
 									read_buffer_t<T>& buffer)
 {
-	auto& bucket = buckets[index.first];
-	bucket.open("rb");
-	
 	const int key_shift = bucket_key_shift - log_num_buckets;
 	if(key_shift < 0) {
 		throw std::logic_error("key_shift < 0");
 	}
+	if(do_abort) {
+		if(!part.file_name.empty()) {
+			std::remove(part.file_name.c_str());
+		}
+		return;
+	}
 	std::unordered_map<size_t, std::vector<T>> table;
-	table.reserve(size_t(1) << log_num_buckets);
+	table.reserve(size_t(1) << (log_num_buckets - part.sub_log));
 	
-	for(size_t i = 0; i < bucket.num_entries;)
-	{
-		const size_t num_entries = std::min(buffer.capacity, bucket.num_entries - i);
-		if(fread(buffer.data, T::disk_size, num_entries, bucket.file) != num_entries) {
-			throw std::runtime_error("fread() failed with: " + std::string(std::strerror(errno)));
+	const auto add_entry = [&](const T& entry) {
+		auto& block = table[Key{}(entry) >> key_shift];
+		if(block.empty()) {
+			block.reserve((part.num_entries >> (log_num_buckets - part.sub_log)) * 1.1);
 		}
-		for(size_t k = 0; k < num_entries; ++k) {
-			T entry;
-			entry.read(buffer.entry_at(k));
-			
-			auto& block = table[Key{}(entry) >> key_shift];
-			if(block.empty()) {
-				block.reserve((bucket.num_entries >> log_num_buckets) * 1.1);
-			}
-			block.push_back(entry);
+		block.push_back(entry);
+	};
+	
+	if(part.file_name.empty()) {
+		read_entries(part.index, buffer, add_entry);
+		if(!keep_files && !keep_sorted) {
+			buckets[part.index].remove();
 		}
-		i += num_entries;
-	}
-	if(!keep_files) {
-		bucket.remove();
+	} else {
+		FILE* file = fopen(part.file_name.c_str(), "rb");
+		if(!file) {
+			throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)));
+		}
+		try {
+			read_raw(file, nullptr, part.file_name, part.num_entries, buffer, add_entry);
+		} catch(...) {
+			fclose(file);
+			throw;
+		}
+		fclose(file);
+		std::remove(part.file_name.c_str());
 	}
 	
 	std::map<size_t, std::vector<T>> sorted;
@@ -225,7 +672,7 @@ void DiskSort<T, Key>::read_bucket(	std::pair<size_t, size_t>& index,
 	table.clear();
 	
 	out.reserve(sorted.size());
-	uint64_t offset = index.second;
+	uint64_t offset = part.offset;
 	for(auto& entry : sorted) {
 		const auto count = entry.second.size();
 		out.emplace_back(std::move(entry.second), offset);
@@ -233,12 +680,324 @@ void DiskSort<T, Key>::read_bucket(	std::pair<size_t, size_t>& index,
 	}
 }
 
+/*
+ * Second pass for buckets which are too large to sort in memory:
+ * Splits the bucket into 2^sub_log part files, on the next sub_log bits of the key.
+ * Parts are written unpacked, empty parts are skipped.
+ */
+template<typename T, typename Key>
+std::vector<typename DiskSort<T, Key>::part_t>
+DiskSort<T, Key>::split_bucket(size_t index, int sub_log, read_buffer_t<T>& buffer)
+{
+	const auto& bucket = buckets[index];
+	const int sub_shift = bucket_key_shift - sub_log;
+	const size_t num_parts = size_t(1) << sub_log;
+	
+	std::vector<part_t> parts(num_parts);
+	std::vector<FILE*> files(num_parts);
+	std::vector<std::unique_ptr<write_buffer_t<T>>> cache(num_parts);
+	
+	const auto write_cache = [&](const size_t i) {
+		auto& buf = *cache[i];
+		if(fwrite(buf.data, T::disk_size, buf.count, files[i]) != buf.count) {
+			throw std::runtime_error("fwrite() failed with: " + std::string(std::strerror(errno)));
+		}
+		buf.count = 0;
+	};
+	const auto close_files = [&]() {
+		for(auto& file : files) {
+			if(file) {
+				fclose(file);
+				file = nullptr;
+			}
+		}
+	};
+	try {
+		for(size_t i = 0; i < num_parts; ++i) {
+			auto& part = parts[i];
+			part.index = index;
+			part.sub_log = sub_log;
+			part.file_name = bucket.file_name + ".part_" + std::to_string(i);
+			files[i] = fopen(part.file_name.c_str(), "wb");
+			if(!files[i]) {
+				throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)));
+			}
+			cache[i] = std::make_unique<write_buffer_t<T>>();
+		}
+		read_entries(index, buffer, [&](const T& entry) {
+			const size_t i = size_t(Key{}(entry) >> sub_shift) & (num_parts - 1);
+			auto& buf = *cache[i];
+			if(buf.count >= buf.capacity) {
+				write_cache(i);
+			}
+			entry.write(buf.entry_at(buf.count++));
+			parts[i].num_entries++;
+		});
+		for(size_t i = 0; i < num_parts; ++i) {
+			write_cache(i);
+			if(fclose(files[i])) {
+				files[i] = nullptr;
+				throw std::runtime_error("fclose() failed with: " + std::string(std::strerror(errno)));
+			}
+			files[i] = nullptr;
+		}
+	} catch(...) {
+		close_files();
+		for(const auto& part : parts) {
+			std::remove(part.file_name.c_str());
+		}
+		throw;
+	}
+	if(!keep_files && !keep_sorted) {
+		buckets[index].remove();
+	}
+	std::vector<part_t> out;
+	for(auto& part : parts) {
+		if(part.num_entries) {
+			out.push_back(std::move(part));
+		} else {
+			std::remove(part.file_name.c_str());
+		}
+	}
+	return out;
+}
+
+// Reads all entries of a bucket
+template<typename T, typename Key>
+template<typename F>
+void DiskSort<T, Key>::read_entries(size_t index, read_buffer_t<T>& buffer, const F& func)
+{
+	auto& bucket = buckets[index];
+	
+	// on tmpfs / ramfs read directly from the page cache
+	std::unique_ptr<MappedFile> map;
+	if(MappedFile::is_memory_fs(bucket.file_name)) {
+		map = std::make_unique<MappedFile>(bucket.file_name);
+	} else {
+		bucket.open("rb");
+	}
+	if(packed_bits) {
+		read_packed(bucket, map.get(), index, func);
+	} else {
+		read_raw(bucket.file, map.get(), bucket.file_name, bucket.num_entries, buffer, func);
+	}
+	bucket.close();
+}
+
+template<typename T, typename Key>
+template<typename F>
+void DiskSort<T, Key>::read_raw(FILE* file, const MappedFile* map, const std::string& file_name,
+								size_t num_entries, read_buffer_t<T>& buffer, const F& func)
+{
+	if(map && map->size() < num_entries * T::disk_size) {
+		throw std::runtime_error("file too small: " + file_name);
+	}
+	for(size_t i = 0; i < num_entries;)
+	{
+		const size_t count = std::min(buffer.capacity, num_entries - i);
+		const uint8_t* src = nullptr;
+		if(map) {
+			src = map->data() + i * T::disk_size;
+			map->prefetch((i + count) * T::disk_size, count * T::disk_size);
+		} else {
+			if(fread(buffer.data, T::disk_size, count, file) != count) {
+				throw std::runtime_error("fread() failed with: " + std::string(std::strerror(errno)));
+			}
+			src = buffer.data;
+		}
+		for(size_t k = 0; k < count; ++k) {
+			T entry;
+			entry.read(src + k * T::disk_size);
+			func(entry);
+		}
+		i += count;
+	}
+}
+
+template<typename T, typename Key>
+template<typename F>
+void DiskSort<T, Key>::read_packed(bucket_t& bucket, const MappedFile* map, size_t index, const F& func)
+{
+	typedef bucket_codec<T, Key> codec_t;
+	if constexpr(codec_t::enabled) {
+		size_t map_offset = 0;
+		const auto read_bytes = [&](void* dst, const size_t num_bytes) {
+			if(map) {
+				if(map_offset + num_bytes > map->size()) {
+					throw std::runtime_error("file too small: " + bucket.file_name);
+				}
+				memcpy(dst, map->data() + map_offset, num_bytes);
+				map_offset += num_bytes;
+			} else if(fread(dst, 1, num_bytes, bucket.file) != num_bytes) {
+				throw std::runtime_error("fread() failed with: " + std::string(std::strerror(errno)));
+			}
+		};
+		const uint64_t key_prefix = uint64_t(index) << bucket_key_shift;
+		std::vector<uint64_t> buffer;
+		for(size_t i = 0; i < bucket.num_entries;)
+		{
+			uint32_t count = 0;
+			read_bytes(&count, sizeof(count));
+			
+			const size_t num_words = bit_words(size_t(count) * packed_bits);
+			buffer.resize(num_words);
+			read_bytes(buffer.data(), num_words * sizeof(uint64_t));
+			if(!count) {
+				throw std::logic_error("empty block in " + bucket.file_name);
+			}
+			bit_reader_t in(buffer.data());
+			for(uint32_t k = 0; k < count; ++k) {
+				T entry;
+				codec_t::unpack(entry, in, key_size, bucket_key_shift, key_prefix);
+				func(entry);
+			}
+			i += count;
+		}
+	}
+}
+
+template<typename T, typename Key>
+DiskSort<T, Key>::BlockReader::BlockReader(DiskSort* disk, int num_threads, bool spill)
+	:	disk(disk),
+		max_ahead(std::max(num_threads, 2))
+{
+	if(!disk->is_finished) {
+		throw std::logic_error("not finished");
+	}
+	if(spill && disk->spill_blocks.empty()) {
+		spill_file = fopen(disk->spill_file_name.c_str(), "wb");
+		if(!spill_file) {
+			throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)));
+		}
+	}
+	job = ThreadCache::instance().run(std::bind(&BlockReader::run, this, num_threads));
+}
+
+template<typename T, typename Key>
+DiskSort<T, Key>::BlockReader::~BlockReader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		do_run = false;		// drop remaining blocks
+	}
+	disk->do_abort = true;	// stop read() at the next bucket
+	signal.notify_all();
+	job->wait();
+	disk->do_abort = false;
+}
+
+template<typename T, typename Key>
+bool DiskSort<T, Key>::BlockReader::next(block_t& block)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(queue.empty() && !is_done) {
+		signal.wait(lock);
+	}
+	if(!ex_what.empty()) {
+		throw std::runtime_error("DiskSort read failed with: " + ex_what);
+	}
+	if(queue.empty()) {
+		return false;
+	}
+	block = std::move(queue.front());
+	queue.pop_front();
+	lock.unlock();
+	signal.notify_all();
+	return true;
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::BlockReader::take(block_t& block)
+{
+	if(spill_file) {
+		thread_local std::vector<uint8_t> buffer;
+		buffer.resize(block.first.size() * T::disk_size);
+		for(size_t i = 0; i < block.first.size(); ++i) {
+			block.first[i].write(buffer.data() + i * T::disk_size);
+		}
+		if(fwrite(buffer.data(), 1, buffer.size(), spill_file) != buffer.size()) {
+			throw std::runtime_error("fwrite() failed with: " + std::string(std::strerror(errno)));
+		}
+		spill_blocks.push_back(block.first.size());
+	}
+	push(block);
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::BlockReader::push(block_t& block)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(do_run && queue.size() >= max_ahead) {
+		signal.wait(lock);
+	}
+	if(do_run) {
+		queue.emplace_back(std::move(block));
+		lock.unlock();
+		signal.notify_all();
+	}
+}
+
+template<typename T, typename Key>
+void DiskSort<T, Key>::BlockReader::run(int num_threads)
+{
+	try {
+		if(disk->spill_blocks.empty()) {
+			disk->read(this, num_threads);
+		} else {
+			FILE* file = fopen(disk->spill_file_name.c_str(), "rb");
+			if(!file) {
+				throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)));
+			}
+			size_t offset = 0;
+			std::vector<uint8_t> buffer;
+			for(const auto count : disk->spill_blocks) {
+				if(disk->do_abort) {
+					break;
+				}
+				buffer.resize(count * T::disk_size);
+				if(fread(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+					fclose(file);
+					throw std::runtime_error("fread() failed with: " + std::string(std::strerror(errno)));
+				}
+				block_t block;
+				block.first.resize(count);
+				for(size_t i = 0; i < count; ++i) {
+					block.first[i].read(buffer.data() + i * T::disk_size);
+				}
+				block.second = offset;
+				offset += count;
+				push(block);
+			}
+			fclose(file);
+		}
+		if(spill_file && !disk->do_abort) {
+			if(fclose(spill_file)) {
+				throw std::runtime_error("fclose() failed with: " + std::string(std::strerror(errno)));
+			}
+			spill_file = nullptr;
+			disk->spill_blocks = std::move(spill_blocks);
+		}
+	} catch(const std::exception& ex) {
+		std::lock_guard<std::mutex> lock(mutex);
+		ex_what = ex.what();
+	}
+	if(spill_file) {
+		fclose(spill_file);
+		std::remove(disk->spill_file_name.c_str());
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_done = true;
+	}
+	signal.notify_all();
+}
+
 template<typename T, typename Key>
 void DiskSort<T, Key>::finish()
 {
 	cache.flush();
 	for(auto& bucket : buckets) {
-		bucket.close();
+		bucket.finish(packed_bits);
 	}
 	is_finished = true;
 }
@@ -248,11 +1007,16 @@ void DiskSort<T, Key>::close()
 {
 	for(auto& bucket : buckets) {
 		bucket.close();
-		if(!keep_files) {
+		if(!keep_files && !keep_sorted) {
 			bucket.remove();
 		}
 	}
 	buckets.clear();
+	
+	if(!spill_blocks.empty()) {
+		std::remove(spill_file_name.c_str());
+		spill_blocks.clear();
+	}
 }
 
 
@@ -9,8 +9,12 @@
 #define INCLUDE_CHIA_DISKTABLE_H_
 
 #include <chia/buffer.h>
+#include <chia/bitpack.h>
+#include <chia/MappedFile.h>
 #include <chia/ThreadPool.h>
 
+#include <memory>
+#include <vector>
 #include <cstdio>
 
 
@@ -20,6 +24,7 @@ private:
 	struct local_t {
 		FILE* file = nullptr;
 		uint8_t* buffer = nullptr;
+		const MappedFile* map = nullptr;
 		~local_t() {
 			if(file) {
 				fclose(file);
@@ -31,7 +36,8 @@ private:
 public:
 	DiskTable(std::string file_name, size_t num_entries = 0)
 		:	file_name(file_name),
-			num_entries(num_entries)
+			num_entries(num_entries),
+			is_packed(packed_codec<T>::enabled && g_bit_pack)
 	{
 		if(!num_entries) {
 			file_out = fopen(file_name.c_str(), "wb");
@@ -44,6 +50,7 @@ public:
 	DiskTable(const table_t& info)
 		:	DiskTable(info.file_name, info.num_entries)
 	{
+		is_packed = packed_codec<T>::enabled && info.is_packed;
 	}
 	
 	~DiskTable() {
@@ -57,6 +64,7 @@ public:
 		table_t out;
 		out.file_name = file_name;
 		out.num_entries = num_entries;
+		out.is_packed = is_packed;
 		return out;
 	}
 	
@@ -64,6 +72,16 @@ public:
 				int num_threads_read = 2,
 				const size_t block_size = g_read_chunk_size) const
 	{
+		// on tmpfs / ramfs read directly from the page cache
+		std::shared_ptr<MappedFile> map;
+		if(MappedFile::is_memory_fs(file_name)) {
+			map = std::make_shared<MappedFile>(file_name);
+			const size_t num_bytes = is_packed ?
+					bit_words(num_entries * packed_codec<T>::num_bits) * sizeof(uint64_t) : num_entries * T::disk_size;
+			if(map->size() < num_bytes) {
+				throw std::runtime_error("file too small: " + file_name);
+			}
+		}
 		ThreadPool<std::pair<size_t, size_t>, std::pair<std::vector<T>, size_t>, local_t> pool(
 			std::bind(&DiskTable::read_block, this,
 					std::placeholders::_1, std::placeholders::_2, std::placeholders::_3),
@@ -71,13 +89,18 @@ public:
 		
 		for(size_t i = 0; i < pool.num_threads(); ++i)
 		{
+			auto& local = pool.get_local(i);
+			if(map) {
+				local.map = map.get();
+				continue;
+			}
 			FILE* file = fopen(file_name.c_str(), "rb");
 			if(!file) {
 				throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)));
 			}
-			auto& local = pool.get_local(i);
 			local.file = file;
-			local.buffer = new uint8_t[block_size * T::disk_size];
+			local.buffer = new uint8_t[std::max(
+					block_size * T::disk_size, (bit_words(block_size * packed_codec<T>::num_bits) + 1) * 8)];
 		}
 		const size_t num_blocks = num_entries / block_size;
 		const size_t left_over = num_entries % block_size;
@@ -106,7 +129,9 @@ public:
 		if(!file_out) {
 			throw std::logic_error("read only");
 		}
-		if(fwrite(cache.data, cache.entry_size, cache.count, file_out) != cache.count) {
+		if(is_packed) {
+			write_packed();
+		} else if(fwrite(cache.data, cache.entry_size, cache.count, file_out) != cache.count) {
 			throw std::runtime_error("fwrite() failed with: " + std::string(std::strerror(errno)));
 		}
 		num_entries += cache.count;
@@ -116,26 +141,101 @@ public:
 	void close() {
 		if(file_out) {
 			flush();
+			if(tail_bits) {
+				if(fwrite(packed.data(), sizeof(uint64_t), 1, file_out) != 1) {
+					throw std::runtime_error("fwrite() failed with: " + std::string(std::strerror(errno)));
+				}
+				tail_bits = 0;
+			}
 			fclose(file_out);
 			file_out = nullptr;
 		}
 	}
 	
 private:
+	// Packs the cache, the last partial word is kept for the next call.
+	void write_packed()
+	{
+		typedef packed_codec<T> codec_t;
+		if constexpr(codec_t::enabled) {
+			const size_t num_bits = tail_bits + cache.count * codec_t::num_bits;
+			packed.resize(bit_words(num_bits) + 1);
+			
+			bit_writer_t out(packed.data(), tail_bits);
+			for(size_t i = 0; i < cache.count; ++i) {
+				T entry;
+				entry.read(cache.entry_at(i));
+				codec_t::pack(entry, out);
+			}
+			const size_t num_words = num_bits / 64;
+			if(fwrite(packed.data(), sizeof(uint64_t), num_words, file_out) != num_words) {
+				throw std::runtime_error("fwrite() failed with: " + std::string(std::strerror(errno)));
+			}
+			tail_bits = num_bits % 64;
+			if(tail_bits) {
+				packed[0] = packed[num_words];
+			}
+		}
+	}
+	
+	void read_packed(	std::pair<size_t, size_t>& param,
+						std::pair<std::vector<T>, size_t>& out,
+						local_t& local) const
+	{
+		typedef packed_codec<T> codec_t;
+		if constexpr(codec_t::enabled) {
+			const size_t begin = param.first * codec_t::num_bits;
+			const size_t end = (param.first + param.second) * codec_t::num_bits;
+			const size_t num_words = bit_words(end) - begin / 64;
+			const uint64_t* words = nullptr;
+			if(local.map) {
+				words = reinterpret_cast<const uint64_t*>(local.map->data()) + begin / 64;
+				local.map->prefetch(bit_words(end) * sizeof(uint64_t), num_words * sizeof(uint64_t));
+			} else {
+				if(fseek(local.file, (begin / 64) * sizeof(uint64_t), SEEK_SET)) {
+					throw std::runtime_error("fseek() failed with: " + std::string(std::strerror(errno)));
+				}
+				auto* buffer = reinterpret_cast<uint64_t*>(local.buffer);
+				if(fread(buffer, sizeof(uint64_t), num_words, local.file) != num_words) {
+					throw std::runtime_error("fread() failed with: " + std::string(std::strerror(errno)));
+				}
+				words = buffer;
+			}
+			bit_reader_t in(words, begin % 64);
+			auto& entries = out.first;
+			entries.resize(param.second);
+			for(auto& entry : entries) {
+				codec_t::unpack(entry, in);
+			}
+			out.second = param.first;
+		}
+	}
+	
 	void read_block(std::pair<size_t, size_t>& param,
 					std::pair<std::vector<T>, size_t>& out,
 					local_t& local) const
 	{
-		if(int err = fseek(local.file, param.first * T::disk_size, SEEK_SET)) {
-			throw std::runtime_error("fseek() failed with: " + std::string(std::strerror(errno)));
+		if(is_packed) {
+			read_packed(param, out, local);
+			return;
 		}
-		if(fread(local.buffer, T::disk_size, param.second, local.file) != param.second) {
-			throw std::runtime_error("fread() failed with: " + std::string(std::strerror(errno)));
+		const uint8_t* src = nullptr;
+		if(local.map) {
+			src = local.map->data() + param.first * T::disk_size;
+			local.map->prefetch((param.first + param.second) * T::disk_size, param.second * T::disk_size);
+		} else {
+			if(int err = fseek(local.file, param.first * T::disk_size, SEEK_SET)) {
+				throw std::runtime_error("fseek() failed with: " + std::string(std::strerror(errno)));
+			}
+			if(fread(local.buffer, T::disk_size, param.second, local.file) != param.second) {
+				throw std::runtime_error("fread() failed with: " + std::string(std::strerror(errno)));
+			}
+			src = local.buffer;
 		}
 		auto& entries = out.first;
 		entries.resize(param.second);
 		for(size_t k = 0; k < param.second; ++k) {
-			entries[k].read(local.buffer + k * T::disk_size);
+			entries[k].read(src + k * T::disk_size);
 		}
 		out.second = param.first;
 	}
@@ -143,10 +243,14 @@ private:
 private:
 	std::string file_name;
 	size_t num_entries;
+	bool is_packed = false;
 	
 	write_buffer_t<T> cache;
 	FILE* file_out = nullptr;
 	
+	size_t tail_bits = 0;				// bits left in packed[0]
+	std::vector<uint64_t> packed;
+	
 };
 
 
@@ -0,0 +1,118 @@
+/*
+ * MappedFile.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_MAPPEDFILE_H_
+#define INCLUDE_CHIA_MAPPEDFILE_H_
+
+#include <string>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#endif
+
+
+/*
+ * Read-only memory mapping of a whole file, for reading directly from the page cache.
+ * Only worth it if the file is in memory anyway (tmpfs / ramfs), see is_memory_fs().
+ */
+class MappedFile {
+public:
+	static constexpr long TMPFS_MAGIC_ = 0x01021994;
+	static constexpr long RAMFS_MAGIC_ = 0x858458f6;
+
+	// Returns true if the file is on tmpfs or ramfs
+	static bool is_memory_fs(const std::string& file_name)
+	{
+#ifdef __linux__
+		struct statfs info = {};
+		if(::statfs(file_name.c_str(), &info)) {
+			return false;
+		}
+		return long(info.f_type) == TMPFS_MAGIC_ || long(info.f_type) == RAMFS_MAGIC_;
+#else
+		return false;
+#endif
+	}
+
+	MappedFile(const std::string& file_name)
+	{
+#ifdef __linux__
+		const int fd = ::open(file_name.c_str(), O_RDONLY);
+		if(fd < 0) {
+			throw std::runtime_error("open() failed with: " + std::string(std::strerror(errno)));
+		}
+		struct stat info = {};
+		if(::fstat(fd, &info)) {
+			::close(fd);
+			throw std::runtime_error("fstat() failed with: " + std::string(std::strerror(errno)));
+		}
+		length = info.st_size;
+		if(length) {
+			void* ptr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+			if(ptr == MAP_FAILED) {
+				::close(fd);
+				throw std::runtime_error("mmap() failed with: " + std::string(std::strerror(errno)));
+			}
+			::madvise(ptr, length, MADV_SEQUENTIAL);
+			data_ = static_cast<const uint8_t*>(ptr);
+		}
+		::close(fd);
+#else
+		throw std::logic_error("MappedFile not supported");
+#endif
+	}
+
+	~MappedFile() {
+#ifdef __linux__
+		if(data_) {
+			::munmap(const_cast<uint8_t*>(data_), length);
+		}
+#endif
+	}
+
+	MappedFile(MappedFile&) = delete;
+	MappedFile& operator=(MappedFile&) = delete;
+
+	const uint8_t* data() const {
+		return data_;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+	// Hint that [offset, offset + num_bytes) will be read soon
+	void prefetch(size_t offset, size_t num_bytes) const
+	{
+#ifdef __linux__
+		if(offset >= length) {
+			return;
+		}
+		const size_t page = ::sysconf(_SC_PAGESIZE);
+		const size_t begin = (offset / page) * page;
+		const size_t end = std::min(offset + num_bytes, length);
+		::madvise(const_cast<uint8_t*>(data_) + begin, end - begin, MADV_WILLNEED);
+#endif
+	}
+
+private:
+	size_t length = 0;
+	const uint8_t* data_ = nullptr;
+
+};
+
+
+#endif /* INCLUDE_CHIA_MAPPEDFILE_H_ */
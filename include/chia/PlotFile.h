@@ -0,0 +1,361 @@
+/*
+ * PlotFile.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_PLOTFILE_H_
+#define INCLUDE_CHIA_PLOTFILE_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+
+
+/*
+ * Plot file for positional writes from any number of threads.
+ * Uses pwrite() / pwritev() on POSIX, a mutex protected FILE* otherwise.
+ *
+ * In stream mode the file is written strictly in ascending order: writes ahead of the
+ * current end are buffered until the gap before them has been filled, writes below
+ * the current end (such as header pointers) are written directly.
+ * Writers block while they are more than max_buffer bytes ahead of the current end.
+ * If a writer fails, abort() wakes up all waiting writers, which then throw.
+ */
+class PlotFile {
+public:
+	/*
+	 * truncate = create new file, otherwise the file has to exist already
+	 * stream = enable stream mode, see above
+	 */
+	PlotFile(const std::string& file_name, bool truncate, bool stream = false, uint64_t max_buffer = uint64_t(256) << 20)
+		:	file_name(file_name), stream(stream), max_buffer(max_buffer)
+	{
+#ifdef _WIN32
+		file = fopen(file_name.c_str(), truncate ? "wb" : "rb+");
+		if(!file) {
+			throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)));
+		}
+#else
+		fd = ::open(file_name.c_str(), O_WRONLY | (truncate ? O_CREAT | O_TRUNC : 0), 0666);
+		if(fd < 0) {
+			throw std::runtime_error("open() failed with: " + std::string(std::strerror(errno)));
+		}
+#endif
+	}
+
+	~PlotFile() {
+		try {
+			close();
+		} catch(...) {
+			// ignore
+		}
+	}
+
+	PlotFile(PlotFile&) = delete;
+	PlotFile& operator=(PlotFile&) = delete;
+
+	// Thread-safe
+	size_t write_at(uint64_t offset, const void* buf, size_t length)
+	{
+		if(stream) {
+			auto src = static_cast<const uint8_t*>(buf);
+			write_stream(offset, std::vector<uint8_t>(src, src + length));
+		} else {
+			write_direct(offset, buf, length);
+		}
+		return length;
+	}
+
+	/*
+	 * Writes a list of T { uint64_t offset; std::vector<uint8_t> buffer; },
+	 * adjacent buffers are combined into one vectored write.
+	 * Thread-safe, list is sorted by offset. In stream mode the buffers are moved.
+	 */
+	template<typename T>
+	void write_all(std::vector<T>& list)
+	{
+		std::sort(list.begin(), list.end(),
+			[](const T& lhs, const T& rhs) -> bool {
+				return lhs.offset < rhs.offset;
+			});
+		if(stream) {
+			for(auto& entry : list) {
+				write_stream(entry.offset, std::move(entry.buffer));
+			}
+			return;
+		}
+#ifdef _WIN32
+		for(const auto& entry : list) {
+			write_direct(entry.offset, entry.buffer.data(), entry.buffer.size());
+		}
+#else
+		for(size_t i = 0; i < list.size();)
+		{
+			std::vector<iovec> vec;
+			const uint64_t offset = list[i].offset;
+			uint64_t end = offset;
+			for(; i < list.size() && list[i].offset == end && vec.size() < IOV_MAX; ++i) {
+				const auto& buffer = list[i].buffer;
+				vec.push_back({(void*)buffer.data(), buffer.size()});
+				end += buffer.size();
+			}
+			write_vector(offset, vec, end - offset);
+		}
+#endif
+	}
+
+	/*
+	 * Stream mode: writes all buffered data, throws if there is a gap (data which was never written).
+	 * Thread-safe, but there should be no more concurrent writes.
+	 */
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock(stream_mutex);
+		while(is_flushing && !is_failed) {
+			stream_signal.wait(lock);
+		}
+		check_failed();
+		for(auto iter = pending.begin(); iter != pending.end(); iter = pending.erase(iter)) {
+			if(iter->first != stream_offset) {
+				fail("missing data at offset " + std::to_string(stream_offset));
+				check_failed();
+			}
+			write_direct(iter->first, iter->second.data(), iter->second.size());
+			stream_offset = iter->first + iter->second.size();
+		}
+		stream_signal.notify_all();
+	}
+
+	/*
+	 * Stream mode: to be called when a writer failed, so that the data it should have written
+	 * will never arrive. All waiting and following writes throw. Thread-safe.
+	 */
+	void abort(const std::string& reason)
+	{
+		std::lock_guard<std::mutex> lock(stream_mutex);
+		fail(reason);
+	}
+
+	void close()
+	{
+		std::exception_ptr error;
+		if(stream) {
+			try {
+				flush();
+			} catch(...) {
+				error = std::current_exception();
+			}
+		}
+#ifdef _WIN32
+		if(file) {
+			const auto res = fclose(file);
+			file = nullptr;
+			if(res && !error) {
+				throw std::runtime_error("fclose() failed with: " + std::string(std::strerror(errno)));
+			}
+		}
+#else
+		if(fd >= 0) {
+			const auto res = ::close(fd);
+			fd = -1;
+			if(res && !error) {
+				throw std::runtime_error("close() failed with: " + std::string(std::strerror(errno)));
+			}
+		}
+#endif
+		if(error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	bool is_stream() const {
+		return stream;
+	}
+
+	const std::string& get_file_name() const {
+		return file_name;
+	}
+
+private:
+	// stream_mutex must be locked
+	void fail(const std::string& reason)
+	{
+		if(!is_failed) {
+			is_failed = true;
+			fail_reason = reason;
+		}
+		stream_signal.notify_all();
+	}
+
+	// stream_mutex must be locked
+	void check_failed() const
+	{
+		if(is_failed) {
+			throw std::runtime_error("PlotFile: " + file_name + " failed: " + fail_reason);
+		}
+	}
+
+	void write_direct(uint64_t offset, const void* buf, size_t length)
+	{
+#ifdef _WIN32
+		std::lock_guard<std::mutex> lock(mutex);
+		if(_fseeki64(file, offset, SEEK_SET)) {
+			throw std::runtime_error("fseek() failed");
+		}
+		if(fwrite(buf, 1, length, file) != length) {
+			throw std::runtime_error("fwrite() failed");
+		}
+#else
+		auto src = static_cast<const uint8_t*>(buf);
+		size_t left = length;
+		while(left) {
+			const auto res = ::pwrite(fd, src, left, offset);
+			if(res < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				throw std::runtime_error("pwrite() failed with: " + std::string(std::strerror(errno)));
+			}
+			src += res;
+			left -= res;
+			offset += res;
+		}
+#endif
+	}
+
+#ifndef _WIN32
+	void write_vector(uint64_t offset, std::vector<iovec>& vec, size_t length)
+	{
+		size_t index = 0;
+		while(length) {
+			const auto res = ::pwritev(fd, vec.data() + index, vec.size() - index, offset);
+			if(res < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				throw std::runtime_error("pwritev() failed with: " + std::string(std::strerror(errno)));
+			}
+			// skip what has been written already, in case of a short write
+			size_t num_bytes = res;
+			length -= num_bytes;
+			offset += num_bytes;
+			while(num_bytes && num_bytes >= vec[index].iov_len) {
+				num_bytes -= vec[index++].iov_len;
+			}
+			if(num_bytes) {
+				vec[index].iov_base = (uint8_t*)vec[index].iov_base + num_bytes;
+				vec[index].iov_len -= num_bytes;
+			}
+		}
+	}
+#endif
+
+	/*
+	 * Whoever fills the gap at the current end writes out all contiguous buffers,
+	 * the other writers just add theirs and return.
+	 */
+	void write_stream(uint64_t offset, std::vector<uint8_t>&& buffer)
+	{
+		std::unique_lock<std::mutex> lock(stream_mutex);
+		check_failed();
+		if(offset < stream_offset) {
+			// patch below the end
+			if(offset + buffer.size() > stream_offset) {
+				throw std::logic_error("PlotFile: write overlaps end of stream");
+			}
+			lock.unlock();
+			write_direct(offset, buffer.data(), buffer.size());
+			return;
+		}
+		while(offset > stream_offset + max_buffer && !is_failed) {
+			stream_signal.wait(lock);
+		}
+		check_failed();
+		if(!pending.emplace(offset, std::move(buffer)).second) {
+			throw std::logic_error("PlotFile: duplicate write at " + std::to_string(offset));
+		}
+		if(is_flushing) {
+			return;
+		}
+		is_flushing = true;
+		while(!is_failed && !pending.empty() && pending.begin()->first == stream_offset)
+		{
+			std::vector<std::vector<uint8_t>> list;
+			uint64_t end = stream_offset;
+			for(auto iter = pending.begin(); iter != pending.end() && iter->first == end && list.size() < 1024;) {
+				end += iter->second.size();
+				list.emplace_back(std::move(iter->second));
+				iter = pending.erase(iter);
+			}
+			const uint64_t begin = stream_offset;
+			lock.unlock();
+			try {
+#ifdef _WIN32
+				uint64_t pos = begin;
+				for(const auto& buf : list) {
+					write_direct(pos, buf.data(), buf.size());
+					pos += buf.size();
+				}
+#else
+				std::vector<iovec> vec;
+				for(const auto& buf : list) {
+					vec.push_back({(void*)buf.data(), buf.size()});
+				}
+				write_vector(begin, vec, end - begin);
+#endif
+			} catch(const std::exception& ex) {
+				lock.lock();
+				is_flushing = false;
+				fail(ex.what());
+				throw;
+			}
+			lock.lock();
+			stream_offset = end;
+			stream_signal.notify_all();
+		}
+		is_flushing = false;
+		stream_signal.notify_all();
+	}
+
+private:
+	std::string file_name;
+	const bool stream;
+	const uint64_t max_buffer;
+#ifdef _WIN32
+	FILE* file = nullptr;
+	std::mutex mutex;
+#else
+	int fd = -1;
+#endif
+
+	// stream mode
+	bool is_flushing = false;
+	bool is_failed = false;
+	std::string fail_reason;
+	uint64_t stream_offset = 0;			// everything below has been written
+	std::map<uint64_t, std::vector<uint8_t>> pending;
+	std::mutex stream_mutex;
+	std::condition_variable stream_signal;
+
+};
+
+
+#endif /* INCLUDE_CHIA_PLOTFILE_H_ */
@@ -0,0 +1,172 @@
+/*
+ * SlidingWindow.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_SLIDINGWINDOW_H_
+#define INCLUDE_CHIA_SLIDINGWINDOW_H_
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <condition_variable>
+
+
+/*
+ * Position indexed append-only window, with one producer and many readers.
+ * Readers access elements in place, without locking, once they have been published.
+ * Memory below the floor (see set_floor()) is freed by the producer.
+ */
+template<typename T, int LOG_SEGMENT = 16>
+class SlidingWindow {
+public:
+	static constexpr uint64_t segment_size = uint64_t(1) << LOG_SEGMENT;
+
+	/*
+	 * max_size = upper bound on total number of elements
+	 * max_window = producer waits while more than this many elements are above the floor,
+	 * 				unless a reader is waiting for data.
+	 */
+	SlidingWindow(const uint64_t max_size, const uint64_t max_window)
+		:	max_window(max_window),
+			segments((max_size + segment_size - 1) / segment_size)
+	{
+	}
+
+	~SlidingWindow() {
+		for(auto segment : segments) {
+			delete [] segment;
+		}
+	}
+
+	SlidingWindow(SlidingWindow&) = delete;
+	SlidingWindow& operator=(SlidingWindow&) = delete;
+
+	// Only one thread may call push() and close()
+	void push(const T* data, const size_t count)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			producer_wait = true;
+			while(num_waiting == 0 && end > floor && end - floor > max_window) {
+				signal_floor.wait(lock);
+			}
+			producer_wait = false;
+		}
+		uint64_t pos = end.load(std::memory_order_relaxed);
+		for(size_t i = 0; i < count;) {
+			const auto index = pos >> LOG_SEGMENT;
+			if(index >= segments.size()) {
+				throw std::logic_error("SlidingWindow: max_size exceeded");
+			}
+			auto& segment = segments[index];
+			if(!segment) {
+				segment = new T[segment_size];
+			}
+			const size_t offset = pos & (segment_size - 1);
+			const size_t n = std::min<size_t>(count - i, segment_size - offset);
+			std::copy(data + i, data + i + n, segment + offset);
+			pos += n;
+			i += n;
+		}
+		end.store(pos);
+
+		if(num_waiting) {
+			std::lock_guard<std::mutex> lock(mutex);
+			signal_data.notify_all();
+		}
+		// free segments which are not needed anymore
+		const auto limit = std::min(floor.load(), pos) >> LOG_SEGMENT;
+		while(num_freed < limit) {
+			delete [] segments[num_freed];
+			segments[num_freed++] = nullptr;
+		}
+	}
+
+	// No more data after this
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_closed = true;
+		signal_data.notify_all();
+	}
+
+	/*
+	 * Waits until element at pos is available.
+	 * Returns false if window was closed before that.
+	 */
+	bool wait(const uint64_t pos)
+	{
+		if(pos < end.load(std::memory_order_acquire)) {
+			return true;
+		}
+		for(int i = 0; i < 100; ++i) {
+			std::this_thread::yield();
+			if(pos < end.load(std::memory_order_acquire)) {
+				return true;
+			}
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		num_waiting++;
+		signal_floor.notify_all();		// don't let the producer wait for us
+		while(pos >= end && !is_closed) {
+			signal_data.wait(lock);
+		}
+		num_waiting--;
+		return pos < end;
+	}
+
+	// Element at pos must be available, see wait()
+	const T& operator[](const uint64_t pos) const {
+		return segments[pos >> LOG_SEGMENT][pos & (segment_size - 1)];
+	}
+
+	/*
+	 * Signals that no reader will access elements below pos anymore.
+	 * Thread-safe, floor only moves forward.
+	 */
+	void set_floor(const uint64_t pos)
+	{
+		auto value = floor.load();
+		while(value < pos) {
+			if(floor.compare_exchange_weak(value, pos)) {
+				if(producer_wait) {
+					std::lock_guard<std::mutex> lock(mutex);
+					signal_floor.notify_all();
+				}
+				break;
+			}
+		}
+	}
+
+	// Number of elements pushed so far
+	uint64_t size() const {
+		return end;
+	}
+
+private:
+	const uint64_t max_window;
+
+	std::atomic<uint64_t> end {0};
+	std::atomic<uint64_t> floor {0};
+	std::atomic<int> num_waiting {0};
+	std::atomic<bool> producer_wait {false};
+	bool is_closed = false;
+
+	uint64_t num_freed = 0;
+	std::vector<T*> segments;
+
+	std::mutex mutex;
+	std::condition_variable signal_data;
+	std::condition_variable signal_floor;
+
+};
+
+
+#endif /* INCLUDE_CHIA_SLIDINGWINDOW_H_ */
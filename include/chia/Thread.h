@@ -8,8 +8,9 @@
 #ifndef INCLUDE_CHIA_THREAD_H_
 #define INCLUDE_CHIA_THREAD_H_
 
+#include <chia/ThreadCache.h>
+
 #include <mutex>
-#include <thread>
 #include <atomic>
 #include <iostream>
 #include <functional>
@@ -39,7 +40,7 @@ public:
 	Thread(const std::function<void(T&)>& func, const std::string& name = "")
 		:	execute(func)
 	{
-		thread = std::thread(&Thread::loop, this, name);
+		job = ThreadCache::instance().run(std::bind(&Thread::loop, this, name));
 	}
 	
 	virtual ~Thread() {
@@ -87,10 +88,11 @@ public:
 		wait();
 		std::unique_lock<std::mutex> lock(mutex);
 		do_run = false;
-		if(thread.joinable()) {
+		if(job) {
 			lock.unlock();
 			signal.notify_all();
-			thread.join();
+			job->wait();
+			job = nullptr;
 		}
 	}
 	
@@ -142,8 +144,8 @@ private:
 	bool is_busy = false;
 	bool is_avail = false;
 	std::mutex mutex;
-	std::thread thread;
 	std::condition_variable signal;
+	std::shared_ptr<ThreadCache::Job> job;
 	std::function<void(T&)> execute;
 	std::string ex_what;
 	
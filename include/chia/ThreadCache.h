@@ -0,0 +1,153 @@
+/*
+ * ThreadCache.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_THREADCACHE_H_
+#define INCLUDE_CHIA_THREADCACHE_H_
+
+#include <chia/numa.h>
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#ifdef _GNU_SOURCE
+#include <pthread.h>
+#endif
+
+
+/*
+ * Global cache of OS threads, which are reused by Thread (and therefore ThreadPool),
+ * instead of creating and joining new threads for every table.
+ * Also keeps thread_local state (like FxMatcher) warm across tables and phases.
+ */
+class ThreadCache {
+public:
+	// Max number of idle threads to keep
+	static constexpr size_t max_idle = 1024;
+
+	class Job {
+	public:
+		// Waits for the function to return [thread-safe]
+		void wait() {
+			std::unique_lock<std::mutex> lock(mutex);
+			while(!is_done) {
+				signal.wait(lock);
+			}
+		}
+	private:
+		void finish() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				is_done = true;
+			}
+			signal.notify_all();
+		}
+		bool is_done = false;
+		std::mutex mutex;
+		std::condition_variable signal;
+		friend class ThreadCache;
+	};
+
+	static ThreadCache& instance() {
+		static ThreadCache cache;
+		return cache;
+	}
+
+	~ThreadCache()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			do_run = false;
+			for(const auto& worker : workers) {
+				worker->signal.notify_all();
+			}
+		}
+		for(const auto& worker : workers) {
+			if(worker->thread.joinable()) {
+				worker->thread.join();
+			}
+		}
+	}
+
+	// Runs func on an idle thread, or a new one [thread-safe]
+	std::shared_ptr<Job> run(const std::function<void()>& func)
+	{
+		auto job = std::make_shared<Job>();
+		std::lock_guard<std::mutex> lock(mutex);
+		worker_t* worker = nullptr;
+		if(idle.empty()) {
+			workers.emplace_back(new worker_t());
+			worker = workers.back().get();
+			worker->thread = std::thread(&ThreadCache::loop, this, worker);
+		} else {
+			worker = idle.back();
+			idle.pop_back();
+		}
+		worker->func = func;
+		worker->job = job;
+		worker->signal.notify_all();
+		return job;
+	}
+
+private:
+	struct worker_t {
+		std::thread thread;
+		std::function<void()> func;
+		std::shared_ptr<Job> job;
+		std::condition_variable signal;
+	};
+
+	ThreadCache() = default;
+
+	void loop(worker_t* worker)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(true) {
+			while(do_run && !worker->func) {
+				worker->signal.wait(lock);
+			}
+			if(!worker->func) {
+				break;
+			}
+			auto func = std::move(worker->func);
+			auto job = std::move(worker->job);
+			worker->func = nullptr;
+			lock.unlock();
+
+			func();
+			func = nullptr;
+			numa::reset_worker();		// undo pinning of ThreadPool workers
+#ifdef _GNU_SOURCE
+			pthread_setname_np(pthread_self(), "idle");
+#endif
+			lock.lock();
+			const bool keep = do_run && idle.size() < max_idle;
+			if(keep) {
+				idle.push_back(worker);
+			}
+			lock.unlock();
+			job->finish();
+			lock.lock();
+			if(!keep) {
+				break;
+			}
+		}
+	}
+
+private:
+	bool do_run = true;
+	std::mutex mutex;
+	std::vector<worker_t*> idle;
+	std::vector<std::unique_ptr<worker_t>> workers;
+
+};
+
+
+#endif /* INCLUDE_CHIA_THREADCACHE_H_ */
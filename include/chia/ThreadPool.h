@@ -9,6 +9,7 @@
 #define INCLUDE_CHIA_THREADPOOL_H_
 
 #include <chia/Thread.h>
+#include <chia/numa.h>
 
 #include <vector>
 #include <memory>
@@ -18,6 +19,8 @@ template<typename T, typename S, typename L = size_t>
 class ThreadPool : public Processor<T> {
 private:
 	struct thread_t {
+		int index = 0;
+		bool is_started = false;
 		uint64_t job = -1;
 		std::mutex mutex;
 		std::condition_variable signal;
@@ -36,6 +39,7 @@ public:
 		}
 		for(int i = 0; i < num_threads; ++i) {
 			threads.push_back(std::make_shared<thread_t>());
+			threads.back()->index = i;
 		}
 		for(int i = 0; i < num_threads; ++i) {
 			threads[i]->thread = std::make_shared<Thread<T>>(
@@ -101,6 +105,10 @@ public:
 private:
 	void wrapper(thread_t* state, thread_t* prev, T& input)
 	{
+		if(!state->is_started) {
+			numa::on_worker_start(state->index);
+			state->is_started = true;
+		}
 		uint64_t job = -1;
 		{
 			std::lock_guard<std::mutex> lock(state->mutex);
@@ -16,6 +16,7 @@
 #define INCLUDE_CHIA_BITFIELD_H_
 
 #include <chia/util.hpp>
+#include <chia/hugepage.h>
 
 #include <memory>
 #include <atomic>
@@ -24,10 +25,14 @@
 struct bitfield
 {
     explicit bitfield(int64_t size)
-        : buffer_(new std::atomic<uint64_t>[(size + 63) / 64])
-        , size_((size + 63) / 64)
+        : size_((size + 63) / 64)
     {
-        clear();
+        const size_t num_bytes = size_ * sizeof(std::atomic<uint64_t>);
+        auto* ptr = static_cast<std::atomic<uint64_t>*>(hugepage::allocate(num_bytes));
+        for(int64_t i = 0; i < size_; ++i) {
+            new(ptr + i) std::atomic<uint64_t>(0);
+        }
+        buffer_ = std::unique_ptr<std::atomic<uint64_t>[], hugepage::deleter>(ptr, hugepage::deleter{num_bytes});
     }
 
     // thread-safe
@@ -99,7 +104,7 @@ struct bitfield
     }
     
 private:
-    std::unique_ptr<std::atomic<uint64_t>[]> buffer_;
+    std::unique_ptr<std::atomic<uint64_t>[], hugepage::deleter> buffer_;
 
     // number of 64-bit words
     int64_t size_;
@@ -58,6 +58,6 @@ struct bitfield_index
     }
 private:
     bitfield const& bitfield_;
-    std::vector<uint64_t> index_;
+    std::vector<uint64_t, hugepage::allocator<uint64_t>> index_;
 };
 
@@ -0,0 +1,117 @@
+/*
+ * bitpack.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_BITPACK_H_
+#define INCLUDE_CHIA_BITPACK_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+
+/*
+ * Little endian bit stream on 64-bit words, values are stored LSB first.
+ * Words are assigned when first touched, so the buffer does not need to be cleared
+ * (when starting at offset 0).
+ */
+struct bit_writer_t {
+	uint64_t* dst = nullptr;
+	size_t offset = 0;			// in bits
+
+	bit_writer_t(uint64_t* dst, size_t offset = 0) : dst(dst), offset(offset) {}
+
+	// num_bits <= 64
+	void write(uint64_t value, const int num_bits)
+	{
+		if(num_bits < 64) {
+			value &= (uint64_t(1) << num_bits) - 1;
+		}
+		const size_t index = offset >> 6;
+		const int shift = offset & 63;
+		if(shift) {
+			dst[index] |= value << shift;
+			if(shift + num_bits > 64) {
+				dst[index + 1] = value >> (64 - shift);
+			}
+		} else {
+			dst[index] = value;
+		}
+		offset += num_bits;
+	}
+
+	void write_bytes(const uint8_t* src, const size_t num_bytes)
+	{
+		size_t i = 0;
+		for(; i + 8 <= num_bytes; i += 8) {
+			uint64_t value;
+			memcpy(&value, src + i, 8);
+			write(value, 64);
+		}
+		for(; i < num_bytes; ++i) {
+			write(src[i], 8);
+		}
+	}
+};
+
+struct bit_reader_t {
+	const uint64_t* src = nullptr;
+	size_t offset = 0;			// in bits
+
+	bit_reader_t(const uint64_t* src, size_t offset = 0) : src(src), offset(offset) {}
+
+	// num_bits <= 64
+	uint64_t read(const int num_bits)
+	{
+		const size_t index = offset >> 6;
+		const int shift = offset & 63;
+		uint64_t value = src[index] >> shift;
+		if(shift && shift + num_bits > 64) {
+			value |= src[index + 1] << (64 - shift);
+		}
+		offset += num_bits;
+		if(num_bits < 64) {
+			value &= (uint64_t(1) << num_bits) - 1;
+		}
+		return value;
+	}
+
+	void read_bytes(uint8_t* dst, const size_t num_bytes)
+	{
+		size_t i = 0;
+		for(; i + 8 <= num_bytes; i += 8) {
+			const auto value = read(64);
+			memcpy(dst + i, &value, 8);
+		}
+		for(; i < num_bytes; ++i) {
+			dst[i] = read(8);
+		}
+	}
+};
+
+// Number of 64-bit words needed for num_bits
+inline
+size_t bit_words(const size_t num_bits) {
+	return (num_bits + 63) / 64;
+}
+
+/*
+ * Fixed width bit-packed format for an entry type, used by DiskTable with g_bit_pack.
+ * Entries are packed back to back, entry i starts at bit i * num_bits.
+ * To enable for an entry type, specialize with:
+ * 	static constexpr bool enabled = true;
+ * 	static constexpr int num_bits = ...;
+ * 	static void pack(const T& entry, bit_writer_t& out);
+ * 	static void unpack(T& entry, bit_reader_t& in);
+ */
+template<typename T>
+struct packed_codec {
+	static constexpr bool enabled = false;
+	static constexpr int num_bits = 0;
+};
+
+
+#endif /* INCLUDE_CHIA_BITPACK_H_ */
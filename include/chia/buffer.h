@@ -9,6 +9,7 @@
 #define INCLUDE_CHIA_BUFFER_H_
 
 #include <chia/settings.h>
+#include <chia/hugepage.h>
 
 
 template<typename T>
@@ -19,10 +20,10 @@ struct byte_buffer_t {
 	static constexpr size_t entry_size = T::disk_size;
 	
 	byte_buffer_t(const size_t capacity) : capacity(capacity) {
-		data = new uint8_t[capacity * entry_size];
+		data = static_cast<uint8_t*>(hugepage::allocate(capacity * entry_size));
 	}
 	~byte_buffer_t() {
-		delete [] data;
+		hugepage::deallocate(data, capacity * entry_size);
 	}
 	uint8_t* entry_at(const size_t i) {
 		return data + i * entry_size;
@@ -78,6 +78,7 @@ static const std::string kFormatDescription = "v1.0";
 struct table_t {
 	std::string file_name;
 	size_t num_entries = 0;
+	bool is_packed = false;		// see DiskTable
 };
 
 
@@ -10,8 +10,13 @@
 
 #include <chia/settings.h>
 
+#include <mutex>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <vector>
+#include <fstream>
+#include <algorithm>
 #include <stdexcept>
 
 #include <cstdio>
@@ -19,10 +24,319 @@
 #include <cstring>
 #include <errno.h>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <sys/sysmacros.h>
+#endif
 
+
+/*
+ * Token bucket to limit the bandwidth of final copies, shared by all copies.
+ * In adaptive mode the rate is halved while the monitored devices have more than
+ * max_inflight requests queued, and slowly raised again while they are idle.
+ * The copies' own share of that I/O is not counted, in case they use the same devices.
+ */
+class RateLimiter {
+public:
+	static constexpr double min_rate = 8 << 20;				// [bytes/s] lower bound in adaptive mode
+	static constexpr double max_auto_rate = double(4ull << 30);	// [bytes/s] unlimited again above
+	static constexpr int64_t update_interval = 200 * 1000;		// [usec]
+
+	// max_rate = [bytes/s], 0 = unlimited
+	RateLimiter(double max_rate = 0)
+		:	max_rate(max_rate), rate(max_rate) {}
+
+	/*
+	 * Enables adaptive mode, for the block devices of the given paths.
+	 * copy_src / copy_dst = directories the copies read from / write to.
+	 * Returns false if none of them can be monitored.
+	 */
+	bool set_adaptive(	const std::vector<std::string>& paths,
+						const std::vector<std::string>& copy_src = {},
+						const std::vector<std::string>& copy_dst = {},
+						int max_inflight = 8)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->max_inflight = max_inflight;
+		for(const auto& path : paths) {
+			const auto dir = get_device_dir(path);
+			if(dir.empty()) {
+				continue;
+			}
+			device_t dev;
+			dev.stat_file = dir + "/stat";
+			if(!read_stat(dev)) {
+				continue;
+			}
+			if(std::find_if(devices.begin(), devices.end(),
+				[&dev](const device_t& other) { return other.stat_file == dev.stat_file; }) != devices.end())
+			{
+				continue;
+			}
+			for(const auto& src : copy_src) {
+				dev.is_copy_src |= get_device_dir(src) == dir;
+			}
+			for(const auto& dst : copy_dst) {
+				dev.is_copy_dst |= get_device_dir(dst) == dir;
+			}
+			devices.push_back(dev);
+		}
+		return !devices.empty();
+	}
+
+	bool is_enabled() const {
+		return max_rate > 0 || !devices.empty();
+	}
+
+	// Blocks until num_bytes may be transferred. Thread-safe.
+	void acquire(const uint64_t num_bytes)
+	{
+		double wait_sec = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			const auto now = get_time_micros();
+			if(!last_update) {
+				last_update = now;
+				last_refill = now;
+			}
+			if(!devices.empty() && now - last_update >= update_interval) {
+				update(now);
+			}
+			num_bytes_total += num_bytes;
+			if(rate <= 0) {
+				return;
+			}
+			// refill, with a burst of up to 100 ms
+			tokens = std::min(tokens + (now - last_refill) * 1e-6 * rate, rate * 0.1);
+			last_refill = now;
+			tokens -= num_bytes;
+			if(tokens < 0) {
+				wait_sec = -tokens / rate;
+			}
+		}
+		if(wait_sec > 0) {
+			std::this_thread::sleep_for(std::chrono::microseconds(int64_t(wait_sec * 1e6)));
+		}
+	}
+
+	// Current rate [bytes/s], 0 = unlimited
+	double get_rate() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return rate;
+	}
+
+private:
+	static int64_t get_time_micros() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	struct device_t {
+		std::string stat_file;
+		bool is_copy_src = false;
+		bool is_copy_dst = false;
+		uint64_t read_sectors = 0;			// at last update
+		uint64_t write_sectors = 0;
+		uint64_t inflight = 0;
+	};
+
+	// Returns "/sys/dev/block/<major>:<minor>" for the device of path, or empty
+	static std::string get_device_dir(const std::string& path)
+	{
+#ifdef __linux__
+		struct stat info = {};
+		if(::stat(path.c_str(), &info) == 0) {
+			return "/sys/dev/block/" + std::to_string(major(info.st_dev)) + ":" + std::to_string(minor(info.st_dev));
+		}
+#endif
+		return std::string();
+	}
+
+	// Reads sector counters and requests in flight, see Documentation/block/stat.rst
+	static bool read_stat(device_t& dev)
+	{
+		std::ifstream in(dev.stat_file);
+		uint64_t field[9] = {};
+		for(auto& value : field) {
+			in >> value;
+		}
+		if(!in) {
+			return false;
+		}
+		dev.read_sectors = field[2];
+		dev.write_sectors = field[6];
+		dev.inflight = field[8];
+		return true;
+	}
+
+	/*
+	 * Requests in flight, not counting the copies: a device's count is scaled by the share
+	 * of sectors since the last update which were not transferred by copies (copy_bytes).
+	 */
+	double get_inflight(const uint64_t copy_bytes)
+	{
+		const uint64_t copy_sectors = copy_bytes / 512;
+		double total = 0;
+		for(auto& dev : devices) {
+			const auto prev = dev;
+			if(!read_stat(dev)) {
+				continue;
+			}
+			const uint64_t reads = dev.read_sectors - prev.read_sectors;
+			const uint64_t writes = dev.write_sectors - prev.write_sectors;
+			const uint64_t own = (dev.is_copy_src ? std::min(reads, copy_sectors) : 0)
+								+ (dev.is_copy_dst ? std::min(writes, copy_sectors) : 0);
+			const uint64_t all = reads + writes;
+			total += all ? dev.inflight * double(all - own) / all : dev.inflight;
+		}
+		return total;
+	}
+
+	void update(const int64_t now)
+	{
+		const auto throughput = num_bytes_total / ((now - last_update) * 1e-6);
+		if(get_inflight(num_bytes_total) > max_inflight) {
+			const auto lower = max_rate > 0 ? std::min(min_rate, max_rate) : min_rate;
+			rate = std::max((rate > 0 ? rate : throughput) / 2, lower);
+		} else if(rate > 0) {
+			rate = rate * 1.25 + min_rate;
+			if(max_rate > 0) {
+				rate = std::min(rate, max_rate);
+			} else if(rate > max_auto_rate) {
+				rate = 0;
+			}
+		}
+		tokens = std::min(tokens, rate * 0.1);
+		num_bytes_total = 0;
+		last_update = now;
+	}
+
+private:
+	const double max_rate;
+	double rate = 0;
+	double tokens = 0;
+	int max_inflight = 8;
+	uint64_t num_bytes_total = 0;		// since last update
+	int64_t last_update = 0;
+	int64_t last_refill = 0;
+	std::vector<device_t> devices;		// monitored in adaptive mode
+
+	mutable std::mutex mutex;
+
+};
+
+
+#ifdef __linux__
+/*
+ * Copies inside the kernel, tries in order: reflink (FICLONE), copy_file_range(), sendfile().
+ * Returns false if none of them is supported for these files, before anything was written.
+ */
 inline
-uint64_t copy_file(const std::string& src_path, const std::string& dst_path)
+bool copy_file_kernel(	const std::string& src_path, const std::string& dst_path, uint64_t& total_bytes,
+						RateLimiter* limiter = nullptr)
 {
+	// smaller chunks when limited, to avoid long bursts
+	const size_t chunk_size = size_t(limiter && limiter->is_enabled() ? 4 : 64) << 20;
+
+	const int src = ::open(src_path.c_str(), O_RDONLY);
+	if(src < 0) {
+		throw std::runtime_error("open() failed for " + src_path + " (" + std::string(std::strerror(errno)) + ")");
+	}
+	struct stat info = {};
+	if(::fstat(src, &info)) {
+		const auto err = errno;
+		::close(src);
+		throw std::runtime_error("fstat() failed for " + src_path + " (" + std::string(std::strerror(err)) + ")");
+	}
+	const int dst = ::open(dst_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(dst < 0) {
+		const auto err = errno;
+		::close(src);
+		throw std::runtime_error("open() failed for " + dst_path + " (" + std::string(std::strerror(err)) + ")");
+	}
+	::posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	const uint64_t file_size = info.st_size;
+	bool success = false;
+	int error = 0;
+	std::string method;
+
+	if(::ioctl(dst, FICLONE, src) == 0) {
+		total_bytes = file_size;
+		success = true;
+	} else {
+		bool use_sendfile = false;
+		total_bytes = 0;
+		while(total_bytes < file_size) {
+			const size_t count = std::min<uint64_t>(chunk_size, file_size - total_bytes);
+			ssize_t res = 0;
+			if(use_sendfile) {
+				res = ::sendfile(dst, src, nullptr, count);
+			} else {
+				res = ::copy_file_range(src, nullptr, dst, nullptr, count, 0);
+			}
+			if(res < 0) {
+				error = errno;
+				if(error == EINTR) {
+					continue;
+				}
+				if(total_bytes == 0) {
+					if(!use_sendfile && (error == ENOSYS || error == EXDEV || error == EINVAL
+						|| error == EOPNOTSUPP || error == EPERM))
+					{
+						use_sendfile = true;
+						continue;
+					}
+					if(use_sendfile && (error == ENOSYS || error == EINVAL)) {
+						break;	// not supported, fall back to user-space copy
+					}
+				}
+				method = use_sendfile ? "sendfile()" : "copy_file_range()";
+				break;
+			}
+			if(res == 0) {
+				error = EIO;
+				method = "copy (file truncated)";
+				break;
+			}
+			// don't keep the source in page cache
+			::posix_fadvise(src, total_bytes, res, POSIX_FADV_DONTNEED);
+			total_bytes += res;
+			if(limiter) {
+				limiter->acquire(res);
+			}
+		}
+		success = total_bytes == file_size;
+	}
+	::posix_fadvise(src, 0, 0, POSIX_FADV_DONTNEED);
+	::close(src);
+
+	if(::close(dst) && success) {
+		throw std::runtime_error("close() failed on " + dst_path + " (" + std::string(std::strerror(errno)) + ")");
+	}
+	if(!method.empty()) {
+		throw std::runtime_error(method + " failed on " + dst_path + " (" + std::string(std::strerror(error)) + ")");
+	}
+	return success;
+}
+#endif
+
+inline
+uint64_t copy_file(const std::string& src_path, const std::string& dst_path, RateLimiter* limiter = nullptr)
+{
+#ifdef __linux__
+	{
+		uint64_t total_bytes = 0;
+		if(copy_file_kernel(src_path, dst_path, total_bytes, limiter)) {
+			return total_bytes;
+		}
+	}
+#endif
 	FILE* src = fopen(src_path.c_str(), "rb");
 	if(!src) {
 		throw std::runtime_error("fopen() failed for " + src_path + " (" + std::string(std::strerror(errno)) + ")");
@@ -36,6 +350,9 @@ uint64_t copy_file(const std::string& src_path, const std::string& dst_path)
 	uint64_t total_bytes = 0;
 	std::vector<uint8_t> buffer(g_read_chunk_size * 16);
 	while(true) {
+		if(limiter) {
+			limiter->acquire(buffer.size());
+		}
 		const auto num_bytes = fread(buffer.data(), 1, buffer.size(), src);
 		if(fwrite(buffer.data(), 1, num_bytes, dst) != num_bytes) {
 			const auto err = errno;
@@ -57,7 +374,7 @@ uint64_t copy_file(const std::string& src_path, const std::string& dst_path)
 }
 
 inline
-uint64_t final_copy(const std::string& src_path, const std::string& dst_path)
+uint64_t final_copy(const std::string& src_path, const std::string& dst_path, RateLimiter* limiter = nullptr)
 {
 	if(src_path == dst_path) {
 		return 0;
@@ -66,7 +383,7 @@ uint64_t final_copy(const std::string& src_path, const std::string& dst_path)
 	uint64_t total_bytes = 109521666048ull;
 	if(rename(src_path.c_str(), tmp_dst_path.c_str())) {
 		// try manual copy
-		total_bytes = copy_file(src_path, tmp_dst_path);
+		total_bytes = copy_file(src_path, tmp_dst_path, limiter);
 	}
 	remove(src_path.c_str());
 	rename(tmp_dst_path.c_str(), dst_path.c_str());
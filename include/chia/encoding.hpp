@@ -29,6 +29,7 @@
 #include "bits.hpp"
 #include "exceptions.hpp"
 #include "util.hpp"
+#include "chia.h"
 
 #include <mutex>
 
@@ -91,6 +92,51 @@ private:
 
 TMemoCache tmCache;
 
+// Index of the C3 table in TANSTables, tables 1-6 use (table_index - 1)
+static constexpr int kANSTableC3 = 6;
+
+// Immutable FSE tables for the final plot tables 1-6 and C3, built once at startup.
+class TANSTables {
+public:
+    static constexpr int num_tables = 7;
+    static constexpr unsigned tableLog = 14;
+
+    TANSTables();
+
+    ~TANSTables()
+    {
+        for (int i = 0; i < num_tables; ++i) {
+            FSE_freeCTable(ct[i]);
+            FSE_freeDTable(dt[i]);
+        }
+    }
+
+    TANSTables(const TANSTables&) = delete;
+    TANSTables& operator=(const TANSTables&) = delete;
+
+    // Returns -1 if R is not one of the prebuilt tables
+    int find(double R_) const
+    {
+        for (int i = 0; i < num_tables; ++i) {
+            if (R[i] == R_) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    const FSE_CTable* CTGet(int index) const { return ct[index]; }
+
+    const FSE_DTable* DTGet(int index) const { return dt[index]; }
+
+private:
+    double R[num_tables] = {};
+    FSE_CTable* ct[num_tables] = {};
+    FSE_DTable* dt[num_tables] = {};
+};
+
+inline const TANSTables ansTables;		// one instance for all translation units
+
 class Encoding {
 public:
     // Calculates x * (x-1) / 2. Division is done before multiplication.
@@ -179,8 +225,17 @@ public:
         return ans;
     }
 
-    static size_t ANSEncodeDeltas(std::vector<unsigned char> deltas, double R, uint8_t *out)
+    static size_t ANSEncodeDeltas(const std::vector<unsigned char>& deltas, double R, uint8_t *out)
+    {
+        return ANSEncodeDeltas(deltas.data(), deltas.size(), R, out);
+    }
+
+    static size_t ANSEncodeDeltas(const uint8_t *deltas, size_t num_deltas, double R, uint8_t *out)
     {
+        const int index = ansTables.find(R);
+        if (index >= 0) {
+            return ANSEncode(index, deltas, num_deltas, out);
+        }
         if (!tmCache.CTExists(R)) {
             std::vector<short> nCount = Encoding::CreateNormalizedCount(R);
             unsigned maxSymbolValue = nCount.size() - 1;
@@ -197,8 +252,35 @@ public:
         }
 
         FSE_CTable *ct = tmCache.CTGet(R);
+        return FSE_compress_usingCTable(out, num_deltas * 8, deltas, num_deltas, ct);
+    }
+
+    // Encodes with one of the prebuilt tables, see TANSTables. Thread-safe, no locking.
+    static size_t ANSEncode(int table, const uint8_t *deltas, size_t num_deltas, uint8_t *out)
+    {
         return FSE_compress_usingCTable(
-            out, deltas.size() * 8, static_cast<void *>(deltas.data()), deltas.size(), ct);
+            out, num_deltas * 8, deltas, num_deltas, ansTables.CTGet(table));
+    }
+
+    // Decodes up to max_deltas with one of the prebuilt tables, returns number of deltas.
+    static size_t ANSDecode(
+        int table,
+        const uint8_t *inp,
+        size_t inp_size,
+        uint8_t *deltas,
+        size_t max_deltas)
+    {
+        const size_t count =
+            FSE_decompress_usingDTable(deltas, max_deltas, inp, inp_size, ansTables.DTGet(table));
+        if (FSE_isError(count)) {
+            throw InvalidStateException(FSE_getErrorName(count));
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (deltas[i] == 0xff) {
+                throw InvalidStateException("Bad delta detected");
+            }
+        }
+        return count;
     }
 
     static void ANSFree(double R)
@@ -212,6 +294,12 @@ public:
         int numDeltas,
         double R)
     {
+        const int index = ansTables.find(R);
+        if (index >= 0) {
+            std::vector<uint8_t> deltas(numDeltas);
+            ANSDecode(index, inp, inp_size, deltas.data(), deltas.size());
+            return deltas;
+        }
         if (!tmCache.DTExists(R)) {
             std::vector<short> nCount = Encoding::CreateNormalizedCount(R);
             unsigned maxSymbolValue = nCount.size() - 1;
@@ -243,4 +331,24 @@ public:
     }
 };
 
+inline TANSTables::TANSTables()
+{
+    for (int i = 0; i < num_tables; ++i) {
+        R[i] = i == kANSTableC3 ? kC3R : kRValues[i];
+        const std::vector<short> nCount = Encoding::CreateNormalizedCount(R[i]);
+        const unsigned maxSymbolValue = nCount.size() - 1;
+
+        ct[i] = FSE_createCTable(maxSymbolValue, tableLog);
+        size_t err = FSE_buildCTable(ct[i], nCount.data(), maxSymbolValue, tableLog);
+        if (FSE_isError(err)) {
+            throw InvalidStateException(FSE_getErrorName(err));
+        }
+        dt[i] = FSE_createDTable(tableLog);
+        err = FSE_buildDTable(dt[i], nCount.data(), maxSymbolValue, tableLog);
+        if (FSE_isError(err)) {
+            throw InvalidStateException(FSE_getErrorName(err));
+        }
+    }
+}
+
 #endif  // SRC_CPP_ENCODING_HPP_
@@ -0,0 +1,134 @@
+/*
+ * hugepage.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_HUGEPAGE_H_
+#define INCLUDE_CHIA_HUGEPAGE_H_
+
+#include <chia/settings.h>
+
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+
+/*
+ * Allocation of large buffers which are accessed randomly (bitfields, lookup tables).
+ * With g_huge_pages, allocations of at least page_size are mapped directly and backed by
+ * hugetlbfs pages if available (MAP_HUGETLB), otherwise by transparent huge pages.
+ * Otherwise (default) everything comes from malloc().
+ */
+namespace hugepage {
+
+static constexpr size_t page_size = size_t(2) << 20;
+
+inline
+size_t round_up(const size_t num_bytes) {
+	return ((num_bytes + page_size - 1) / page_size) * page_size;
+}
+
+/*
+ * Returns true if an allocation of num_bytes is mapped directly.
+ * g_huge_pages is latched at the first call, so that deallocate() always matches allocate().
+ */
+inline
+bool is_mapped(const size_t num_bytes)
+{
+#ifndef _WIN32
+	static const bool enable = g_huge_pages;
+	return enable && num_bytes >= page_size;
+#else
+	return false;
+#endif
+}
+
+// Throws std::bad_alloc
+inline
+void* allocate(const size_t num_bytes)
+{
+#ifndef _WIN32
+	if(is_mapped(num_bytes)) {
+		const auto length = round_up(num_bytes);
+		void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		ptr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+		if(ptr == MAP_FAILED) {
+			ptr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if(ptr == MAP_FAILED) {
+				throw std::bad_alloc();
+			}
+#ifdef MADV_HUGEPAGE
+			::madvise(ptr, length, MADV_HUGEPAGE);
+#endif
+		}
+		return ptr;
+	}
+#endif
+	if(void* ptr = std::malloc(num_bytes ? num_bytes : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+// num_bytes = same as for allocate()
+inline
+void deallocate(void* ptr, const size_t num_bytes)
+{
+	if(!ptr) {
+		return;
+	}
+#ifndef _WIN32
+	if(is_mapped(num_bytes)) {
+		::munmap(ptr, round_up(num_bytes));
+		return;
+	}
+#endif
+	std::free(ptr);
+}
+
+// For std::unique_ptr
+struct deleter {
+	size_t num_bytes = 0;
+	void operator()(void* ptr) const {
+		deallocate(ptr, num_bytes);
+	}
+};
+
+// For std::vector
+template<typename T>
+struct allocator {
+	typedef T value_type;
+
+	allocator() = default;
+
+	template<typename S>
+	allocator(const allocator<S>&) {}
+
+	T* allocate(const size_t n) {
+		return static_cast<T*>(hugepage::allocate(n * sizeof(T)));
+	}
+	void deallocate(T* ptr, const size_t n) {
+		hugepage::deallocate(ptr, n * sizeof(T));
+	}
+	template<typename S>
+	bool operator==(const allocator<S>&) const {
+		return true;
+	}
+	template<typename S>
+	bool operator!=(const allocator<S>&) const {
+		return false;
+	}
+};
+
+
+} // hugepage
+
+#endif /* INCLUDE_CHIA_HUGEPAGE_H_ */
@@ -0,0 +1,197 @@
+/*
+ * numa.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_NUMA_H_
+#define INCLUDE_CHIA_NUMA_H_
+
+#include <chia/settings.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+
+
+/*
+ * NUMA support without libnuma, topology is read from /sys/devices/system/node.
+ * Memory placement relies on first-touch: buffers allocated and filled by a pinned
+ * worker (like WriteCache, read buffers, match buffers) end up on its node.
+ */
+namespace numa {
+
+#ifdef __linux__
+static constexpr int MPOL_PREFERRED_ = 1;
+static constexpr int MPOL_BIND_ = 2;
+#endif
+
+// Parses a cpulist like "0-7,16-23"
+inline
+std::vector<int> parse_cpu_list(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::stringstream ss(list);
+	std::string range;
+	while(std::getline(ss, range, ',')) {
+		const auto pos = range.find('-');
+		try {
+			const int first = std::stoi(range.substr(0, pos));
+			const int last = pos != std::string::npos ? std::stoi(range.substr(pos + 1)) : first;
+			for(int i = first; i <= last; ++i) {
+				cpus.push_back(i);
+			}
+		} catch(...) {
+			// ignore
+		}
+	}
+	return cpus;
+}
+
+// Returns CPUs for each node, empty if not available
+inline
+const std::vector<std::vector<int>>& get_node_cpus()
+{
+	static const std::vector<std::vector<int>> nodes = []() {
+		std::vector<std::vector<int>> out;
+		for(int node = 0; ; ++node) {
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			std::string list;
+			if(!file || !std::getline(file, list)) {
+				break;
+			}
+			out.push_back(parse_cpu_list(list));
+		}
+		return out;
+	}();
+	return nodes;
+}
+
+inline
+int get_num_nodes() {
+	return get_node_cpus().size();
+}
+
+#ifdef __linux__
+inline
+bool set_affinity(pthread_t thread, const std::vector<int>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(const auto cpu : cpus) {
+		if(cpu < CPU_SETSIZE) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+inline
+bool set_mempolicy(int mode, int node)
+{
+	const unsigned long mask = 1ul << node;
+	return ::syscall(SYS_set_mempolicy, mode, &mask, sizeof(mask) * 8) == 0;
+}
+#endif
+
+/*
+ * Binds the calling thread (and all threads created by it later) to a node,
+ * memory is only allocated from this node. Call before starting any work.
+ */
+inline
+bool bind_node(int node)
+{
+	const auto& nodes = get_node_cpus();
+	if(node < 0 || node >= int(nodes.size()) || node >= 64) {
+		return false;
+	}
+#ifdef __linux__
+	return set_affinity(pthread_self(), nodes[node]) && set_mempolicy(MPOL_BIND_, node);
+#else
+	return false;
+#endif
+}
+
+#ifdef __linux__
+// Affinity and memory policy of a thread before on_worker_start(), see reset_worker()
+struct saved_state_t {
+	bool is_pinned = false;
+	cpu_set_t affinity;
+	int mode = 0;
+	unsigned long mask[16] = {};
+};
+
+inline
+saved_state_t& get_saved_state() {
+	thread_local saved_state_t state;
+	return state;
+}
+#endif
+
+/*
+ * Called once by every ThreadPool worker (index = worker index within the pool).
+ * With g_numa_spread the workers are pinned round robin to the nodes,
+ * and prefer memory from their own node.
+ */
+inline
+void on_worker_start(int index)
+{
+	if(!g_numa_spread) {
+		return;
+	}
+	const auto& nodes = get_node_cpus();
+	if(nodes.size() < 2) {
+		return;
+	}
+	const int node = index % std::min<int>(nodes.size(), 64);
+#ifdef __linux__
+	auto& state = get_saved_state();
+	if(!state.is_pinned) {
+		if(pthread_getaffinity_np(pthread_self(), sizeof(state.affinity), &state.affinity)) {
+			return;
+		}
+		if(::syscall(SYS_get_mempolicy, &state.mode, state.mask, sizeof(state.mask) * 8, nullptr, 0)) {
+			state.mode = 0;		// MPOL_DEFAULT
+		}
+		state.is_pinned = true;
+	}
+	set_affinity(pthread_self(), nodes[node]);
+	set_mempolicy(MPOL_PREFERRED_, node);
+#endif
+}
+
+/*
+ * Undoes on_worker_start(), called by ThreadCache before a thread goes back to idle,
+ * so that it can be reused for threads which are not pinned.
+ */
+inline
+void reset_worker()
+{
+#ifdef __linux__
+	auto& state = get_saved_state();
+	if(state.is_pinned) {
+		pthread_setaffinity_np(pthread_self(), sizeof(state.affinity), &state.affinity);
+		if(state.mode) {
+			::syscall(SYS_set_mempolicy, state.mode, state.mask, sizeof(state.mask) * 8);
+		} else {
+			::syscall(SYS_set_mempolicy, 0, nullptr, 0);
+		}
+		state.is_pinned = false;
+	}
+#endif
+}
+
+
+} // numa
+
+#endif /* INCLUDE_CHIA_NUMA_H_ */
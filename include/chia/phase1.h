@@ -254,6 +254,31 @@ struct set_meta<entry_7> {
 	}
 };
 
+/*
+ * Entries with the same y / kBC, with y % kBC stored as a separate column,
+ * since matching only needs y.
+ */
+template<typename T>
+struct bucket_t {
+	std::vector<uint16_t> y;		// y % kBC
+	std::vector<T> entries;
+	
+	void push_back(const T& entry) {
+		y.push_back(entry.y % kBC);
+		entries.push_back(entry);
+	}
+	void reserve(const size_t count) {
+		y.reserve(count);
+		entries.reserve(count);
+	}
+	size_t size() const {
+		return entries.size();
+	}
+	bool empty() const {
+		return entries.empty();
+	}
+};
+
 template<typename T>
 struct match_t {
 	T left;
@@ -278,4 +303,85 @@ struct output_t {
 
 } // phase1
 
+// Packed bucket format, see bucket_codec in DiskSort.h
+template<>
+struct bucket_codec<phase1::entry_1, phase1::get_y<phase1::entry_1>> {
+	static constexpr bool enabled = true;
+	static int get_bits(int key_size, int key_bits) {
+		return key_bits + (key_size - kExtraBits);
+	}
+	static void pack(const phase1::entry_1& entry, bit_writer_t& out, int key_size, int key_bits) {
+		out.write(entry.y, key_bits);
+		out.write(entry.x, key_size - kExtraBits);
+	}
+	static void unpack(phase1::entry_1& entry, bit_reader_t& in, int key_size, int key_bits, uint64_t key_prefix) {
+		entry.y = key_prefix | in.read(key_bits);
+		entry.x = in.read(key_size - kExtraBits);
+	}
+};
+
+template<int N>
+struct bucket_codec<phase1::entry_xm<N>, phase1::get_y<phase1::entry_xm<N>>> {
+	static constexpr bool enabled = true;
+	static int get_bits(int key_size, int key_bits) {
+		return key_bits + 10 + PMAX + N * 8;
+	}
+	static void pack(const phase1::entry_xm<N>& entry, bit_writer_t& out, int key_size, int key_bits) {
+		out.write(entry.y, key_bits);
+		out.write(entry.off, 10);
+		out.write(entry.pos, PMAX);
+		out.write_bytes(entry.meta.data(), N);
+	}
+	static void unpack(phase1::entry_xm<N>& entry, bit_reader_t& in, int key_size, int key_bits, uint64_t key_prefix) {
+		entry.y = key_prefix | in.read(key_bits);
+		entry.off = in.read(10);
+		entry.pos = in.read(PMAX);
+		in.read_bytes(entry.meta.data(), N);
+	}
+};
+
+// Packed table format, see packed_codec in bitpack.h
+template<>
+struct packed_codec<phase1::tmp_entry_1> {
+	static constexpr bool enabled = true;
+	static constexpr int num_bits = KMAX;
+	static void pack(const phase1::tmp_entry_1& entry, bit_writer_t& out) {
+		out.write(entry.x, KMAX);
+	}
+	static void unpack(phase1::tmp_entry_1& entry, bit_reader_t& in) {
+		entry.x = in.read(KMAX);
+	}
+};
+
+template<>
+struct packed_codec<phase1::tmp_entry_x> {
+	static constexpr bool enabled = true;
+	static constexpr int num_bits = PMAX + 10;
+	static void pack(const phase1::tmp_entry_x& entry, bit_writer_t& out) {
+		out.write(entry.pos, PMAX);
+		out.write(entry.off, 10);
+	}
+	static void unpack(phase1::tmp_entry_x& entry, bit_reader_t& in) {
+		entry.pos = in.read(PMAX);
+		entry.off = in.read(10);
+	}
+};
+
+template<>
+struct packed_codec<phase1::entry_7> {
+	static constexpr bool enabled = true;
+	static constexpr int num_bits = KMAX + PMAX + 10;
+	static void pack(const phase1::entry_7& entry, bit_writer_t& out) {
+		out.write(entry.y, KMAX);
+		out.write(entry.pos, PMAX);
+		out.write(entry.off, 10);
+	}
+	static void unpack(phase1::entry_7& entry, bit_reader_t& in) {
+		entry.y = in.read(KMAX);
+		entry.pos = in.read(PMAX);
+		entry.off = in.read(10);
+	}
+};
+
+
 #endif /* INCLUDE_CHIA_PHASE1_H_ */
@@ -12,6 +12,7 @@
 #include <chia/ThreadPool.h>
 #include <chia/DiskTable.h>
 #include <chia/bits.hpp>
+#include <chia/hugepage.h>
 
 #include "blake3.h"
 #include "chacha8.h"
@@ -19,10 +20,18 @@
 
 namespace phase1 {
 
-static uint16_t L_targets[2][kBC][kExtraBitsPow];
+// [2][kBC][kExtraBitsPow], accessed randomly
+static std::unique_ptr<uint16_t[][kBC][kExtraBitsPow], hugepage::deleter> L_targets;
 
 static void load_tables()
 {
+	if(L_targets) {
+		return;
+	}
+	const size_t num_bytes = 2 * sizeof(uint16_t[kBC][kExtraBitsPow]);
+	L_targets = std::unique_ptr<uint16_t[][kBC][kExtraBitsPow], hugepage::deleter>(
+			static_cast<uint16_t(*)[kBC][kExtraBitsPow]>(hugepage::allocate(num_bytes)), hugepage::deleter{num_bytes});
+
     for (uint8_t parity = 0; parity < 2; parity++) {
         for (uint16_t i = 0; i < kBC; i++) {
             uint16_t indJ = i / kC;
@@ -165,6 +174,12 @@ public:
     // Disable copying
     FxMatcher(const FxMatcher&) = delete;
 
+    // Instance of the calling thread, kept across tables
+    static FxMatcher& get_local() {
+    	static thread_local FxMatcher instance;
+    	return instance;
+    }
+
     // Given two buckets with entries (y values), computes which y values match, and returns a list
     // of the pairs of indices into bucket_L and bucket_R. Indices l and r match iff:
     //   let  yl = bucket_L[l].y,  yr = bucket_R[r].y
@@ -178,25 +193,22 @@ public:
     // bucket length, we can store all the R values and lookup each of our 32 candidates to see if
     // any R value matches. This function can be further optimized by removing the inner loop, and
     // being more careful with memory allocation.
+    //
+    // y_L and y_R are the y values modulo kBC, parity = (L bucket index) % 2.
     int find_matches_ex(
-        const std::vector<T>& bucket_L,
-        const std::vector<T>& bucket_R,
+        const uint16_t* y_L, const size_t num_L,
+        const uint16_t* y_R, const size_t num_R,
+        const uint16_t parity,
         uint16_t* idx_L,
         uint16_t* idx_R)
     {
-        if(bucket_L.empty() || bucket_R.empty()) {
-        	return 0;
-        }
-    	const uint16_t parity = (bucket_L[0].y / kBC) % 2;
-
         for (auto yl : rmap_clean) {
             rmap[yl].count = 0;
         }
         rmap_clean.clear();
 
-        const uint64_t offset = (bucket_R[0].y / kBC) * kBC;
-        for (size_t pos_R = 0; pos_R < bucket_R.size(); pos_R++) {
-            const uint64_t r_y = bucket_R[pos_R].y - offset;
+        for (size_t pos_R = 0; pos_R < num_R; pos_R++) {
+            const uint16_t r_y = y_R[pos_R];
 
             auto& entry = rmap[r_y];
             if (!entry.count) {
@@ -207,9 +219,8 @@ public:
         }
 
         int idx_count = 0;
-        const uint64_t offset_y = offset - kBC;
-        for (size_t pos_L = 0; pos_L < bucket_L.size(); pos_L++) {
-            const uint64_t r = bucket_L[pos_L].y - offset_y;
+        for (size_t pos_L = 0; pos_L < num_L; pos_L++) {
+            const uint16_t r = y_L[pos_L];
             for (int i = 0; i < kExtraBitsPow; i++) {
                 const uint16_t r_target = L_targets[parity][r][i];
                 for (size_t j = 0; j < rmap[r_target].count; j++) {
@@ -223,13 +234,18 @@ public:
     }
     
     int find_matches(	const uint64_t& L_pos_begin,
-						const std::vector<T>& bucket_L,
-						const std::vector<T>& bucket_R,
+						const bucket_t<T>& bucket_L,
+						const bucket_t<T>& bucket_R,
 						std::vector<match_t<T>>& out)
 	{
+    	if(bucket_L.empty() || bucket_R.empty()) {
+    		return 0;
+    	}
     	uint16_t idx_L[kBC];
 		uint16_t idx_R[kBC];
-		const int count = find_matches_ex(bucket_L, bucket_R, idx_L, idx_R);
+		const int count = find_matches_ex(
+				bucket_L.y.data(), bucket_L.size(), bucket_R.y.data(), bucket_R.size(),
+				(bucket_L.entries[0].y / kBC) % 2, idx_L, idx_R);
 		
 		if(count > kBC) {
 			throw std::logic_error("find_matches(): count > kBC");
@@ -240,8 +256,8 @@ public:
 				continue;
 			}
 			match_t<T> match;
-			match.left = bucket_L[idx_L[i]];
-			match.right = bucket_R[idx_R[i]];
+			match.left = bucket_L.entries[idx_L[i]];
+			match.right = bucket_R.entries[idx_R[i]];
 			match.pos = pos;
 			match.off = idx_R[i] + (bucket_L.size() - idx_L[i]);
 			out.push_back(match);
@@ -305,12 +321,12 @@ uint64_t compute_matches(	int R_index, int k, int num_threads,
 	std::atomic<uint64_t> num_written {};
 	std::array<uint64_t, 2> L_index = {};
 	std::array<uint64_t, 2> L_offset = {};
-	std::array<std::shared_ptr<std::vector<T>>, 2> L_bucket;
+	std::array<std::shared_ptr<bucket_t<T>>, 2> L_bucket;
 	double avg_bucket_size = 0;
 	
 	struct match_input_t {
 		std::array<uint64_t, 2> L_offset = {};
-		std::array<std::shared_ptr<std::vector<T>>, 2> L_bucket;
+		std::array<std::shared_ptr<bucket_t<T>>, 2> L_bucket;
 	};
 	
 	typedef typename DS_R::WriteCache WriteCache;
@@ -343,9 +359,10 @@ uint64_t compute_matches(	int R_index, int k, int num_threads,
 			}
 		}, R_out, num_threads, "phase1/eval");
 	
-	ThreadPool<std::vector<match_input_t>, std::vector<match_t<T>>, FxMatcher<T>> match_pool(
+	ThreadPool<std::vector<match_input_t>, std::vector<match_t<T>>> match_pool(
 		[&num_found, &num_written]
-		 (std::vector<match_input_t>& input, std::vector<match_t<T>>& out, FxMatcher<T>& Fx) {
+		 (std::vector<match_input_t>& input, std::vector<match_t<T>>& out, size_t&) {
+			auto& Fx = FxMatcher<T>::get_local();
 			out.reserve(64 * 1024);
 			for(const auto& pair : input) {
 				num_found += Fx.find_matches(pair.L_offset[1], *pair.L_bucket[1], *pair.L_bucket[0], out);
@@ -381,7 +398,7 @@ uint64_t compute_matches(	int R_index, int k, int num_threads,
 					L_bucket[0] = nullptr;
 				}
 				if(!L_bucket[0]) {
-					L_bucket[0] = std::make_shared<std::vector<T>>();
+					L_bucket[0] = std::make_shared<bucket_t<T>>();
 					L_bucket[0]->reserve(avg_bucket_size * 1.2);
 				}
 				L_bucket[0]->push_back(entry);
@@ -398,7 +415,7 @@ uint64_t compute_matches(	int R_index, int k, int num_threads,
 	match_pool.close();
 	
 	if(L_index[1] + 1 == L_index[0]) {
-		FxMatcher<T> Fx;
+		auto& Fx = FxMatcher<T>::get_local();
 		std::vector<match_t<T>> matches;
 		num_found += Fx.find_matches(L_offset[1], *L_bucket[1], *L_bucket[0], matches);
 		num_written += matches.size();
@@ -474,31 +491,37 @@ void compute(	const input_t& input, output_t& out,
 	const std::string prefix = tmp_dir + plot_name + ".p1.";
 	const std::string prefix_2 = tmp_dir_2 + plot_name + ".p1.";
 	
-	DiskSort1 sort_1(k + kExtraBits, log_num_buckets, prefix_2 + "t1");
+	DiskSort1 sort_1(k + kExtraBits,
+			get_log_num_buckets<entry_1>(log_num_buckets, k, num_threads, "[P1] Table 1"), prefix_2 + "t1");
 	compute_f1(input.id.data(), k, num_threads, &sort_1);
 	
 	DiskTable<tmp_entry_1> tmp_1(prefix + "table1.tmp");
-	DiskSort2 sort_2(k + kExtraBits, log_num_buckets, prefix_2 + "t2");
+	DiskSort2 sort_2(k + kExtraBits,
+			get_log_num_buckets<entry_2>(log_num_buckets, k, num_threads, "[P1] Table 2"), prefix_2 + "t2");
 	compute_table<entry_1, entry_2, tmp_entry_1>(
 			2, k, num_threads, &sort_1, &sort_2, &tmp_1);
 	
 	DiskTable<tmp_entry_x> tmp_2(prefix + "table2.tmp");
-	DiskSort3 sort_3(k + kExtraBits, log_num_buckets, prefix_2 + "t3");
+	DiskSort3 sort_3(k + kExtraBits,
+			get_log_num_buckets<entry_3>(log_num_buckets, k, num_threads, "[P1] Table 3"), prefix_2 + "t3");
 	compute_table<entry_2, entry_3, tmp_entry_x>(
 			3, k, num_threads, &sort_2, &sort_3, &tmp_2);
 	
 	DiskTable<tmp_entry_x> tmp_3(prefix + "table3.tmp");
-	DiskSort4 sort_4(k + kExtraBits, log_num_buckets, prefix_2 + "t4");
+	DiskSort4 sort_4(k + kExtraBits,
+			get_log_num_buckets<entry_4>(log_num_buckets, k, num_threads, "[P1] Table 4"), prefix_2 + "t4");
 	compute_table<entry_3, entry_4, tmp_entry_x>(
 			4, k, num_threads, &sort_3, &sort_4, &tmp_3);
 	
 	DiskTable<tmp_entry_x> tmp_4(prefix + "table4.tmp");
-	DiskSort5 sort_5(k + kExtraBits, log_num_buckets, prefix_2 + "t5");
+	DiskSort5 sort_5(k + kExtraBits,
+			get_log_num_buckets<entry_5>(log_num_buckets, k, num_threads, "[P1] Table 5"), prefix_2 + "t5");
 	compute_table<entry_4, entry_5, tmp_entry_x>(
 			5, k, num_threads, &sort_4, &sort_5, &tmp_4);
 	
 	DiskTable<tmp_entry_x> tmp_5(prefix + "table5.tmp");
-	DiskSort6 sort_6(k + kExtraBits, log_num_buckets, prefix_2 + "t6");
+	DiskSort6 sort_6(k + kExtraBits,
+			get_log_num_buckets<entry_6>(log_num_buckets, k, num_threads, "[P1] Table 6"), prefix_2 + "t6");
 	compute_table<entry_5, entry_6, tmp_entry_x>(
 			6, k, num_threads, &sort_5, &sort_6, &tmp_5);
 	
@@ -110,4 +110,24 @@ struct output_t {
 
 } // phase2
 
+// Packed bucket format, see bucket_codec in DiskSort.h
+template<>
+struct bucket_codec<phase2::entry_x, phase2::get_pos<phase2::entry_x>> {
+	static constexpr bool enabled = true;
+	static int get_bits(int key_size, int key_bits) {
+		return key_bits + PMAX + 10;
+	}
+	static void pack(const phase2::entry_x& entry, bit_writer_t& out, int key_size, int key_bits) {
+		out.write(entry.pos, key_bits);
+		out.write(entry.key, PMAX);
+		out.write(entry.off, 10);
+	}
+	static void unpack(phase2::entry_x& entry, bit_reader_t& in, int key_size, int key_bits, uint64_t key_prefix) {
+		entry.pos = key_prefix | in.read(key_bits);
+		entry.key = in.read(PMAX);
+		entry.off = in.read(10);
+	}
+};
+
+
 #endif /* INCLUDE_CHIA_PHASE2_H_ */
@@ -141,6 +141,8 @@ void compute(	const phase1::output_t& input, output_t& out,
 	}
 	std::cout << "[P2] max_table_size = " << max_table_size << std::endl;
 	
+	const int log_num_buckets_x = get_log_num_buckets<entry_x>(log_num_buckets, k, num_threads, "[P2]");
+	
 	auto curr_bitfield = std::make_shared<bitfield>(max_table_size);
 	auto next_bitfield = std::make_shared<bitfield>(max_table_size);
 	
@@ -155,7 +157,7 @@ void compute(	const phase1::output_t& input, output_t& out,
 	for(int i = 5; i >= 1; --i)
 	{
 		std::swap(curr_bitfield, next_bitfield);
-		out.sort[i] = std::make_shared<DiskSortT>(k, log_num_buckets, (i == 1 ? prefix_2 : prefix) + "t" + std::to_string(i + 1));
+		out.sort[i] = std::make_shared<DiskSortT>(k, log_num_buckets_x, (i == 1 ? prefix_2 : prefix) + "t" + std::to_string(i + 1));
 		
 		compute_table<phase1::tmp_entry_x, entry_x, DiskSortT>(
 			i + 1, num_threads, out.sort[i].get(), nullptr, input.table[i], next_bitfield.get(), curr_bitfield.get());
@@ -9,6 +9,7 @@
 #define INCLUDE_CHIA_PHASE3_H_
 
 #include <chia/phase2.h>
+#include <chia/PlotFile.h>
 
 
 namespace phase3 {
@@ -136,6 +137,7 @@ struct output_t {
 	uint64_t final_pointer_7 = 0;
 	phase1::input_t params;
 	std::string plot_file_name;
+	std::shared_ptr<PlotFile> plot_file;		// still open, for phase 4
 	std::shared_ptr<DiskSortNP> sort_7;
 };
 
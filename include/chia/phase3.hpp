@@ -12,8 +12,8 @@
 #include <chia/phase3.h>
 #include <chia/encoding.hpp>
 #include <chia/DiskTable.h>
-
-#include <list>
+#include <chia/PlotFile.h>
+#include <chia/SlidingWindow.h>
 
 
 namespace phase3 {
@@ -27,43 +27,18 @@ void compute_stage1(int L_index, int num_threads,
 	const auto begin = get_wall_time_micros();
 	const int num_threads_merge = std::max(num_threads / 4, 1);
 	
-	struct merge_buffer_t {
-		uint64_t offset = 0;					// position offset at buffer[0]
-		std::vector<uintkx_t> new_pos;			// new_pos buffer
-		int copy_sync = 0;						// copy counter
-	};
-	
-	std::mutex mutex;
-	std::condition_variable signal;
-	std::condition_variable signal_1;
-	
-	bool L_is_end = false;
-	bool R_is_end = false;
-	uint64_t L_num_read = 0;
-	std::list<merge_buffer_t> L_input;			// double buffer
+	// new_pos of all used left entries, indexed by old position
+	SlidingWindow<uintkx_t> L_window(uint64_t(1) << (KMAX + 1), uint64_t(1) << 24);
 	std::atomic<uint64_t> R_num_write {0};
 	
 	Thread<std::pair<std::vector<entry_np>, size_t>> L_read(
-		[&mutex, &signal, &signal_1, &L_input, &L_num_read, &R_is_end, num_threads_merge]
-		 (std::pair<std::vector<entry_np>, size_t>& input) {
-			merge_buffer_t tmp;
-			tmp.offset = L_num_read;
-			tmp.new_pos.reserve(input.first.size());
+		[&L_window](std::pair<std::vector<entry_np>, size_t>& input) {
+			std::vector<uintkx_t> new_pos;
+			new_pos.reserve(input.first.size());
 			for(const auto& entry : input.first) {
-				tmp.new_pos.push_back(entry.pos);
-			}
-			L_num_read += tmp.new_pos.size();
-			
-			std::unique_lock<std::mutex> lock(mutex);
-			while(!L_input.empty() && L_input.back().copy_sync == 0 && !R_is_end) {
-				signal_1.wait(lock);	// wait for latest data to be processed by at least one thread
-			}
-			while(!L_input.empty() && L_input.front().copy_sync >= num_threads_merge) {
-				L_input.pop_front();	// delete data which has already been copied by all threads
+				new_pos.push_back(entry.pos);
 			}
-			L_input.emplace_back(std::move(tmp));
-			lock.unlock();
-			signal.notify_all();
+			L_window.push(new_pos.data(), new_pos.size());
 		}, "phase3/buffer");
 	
 	ThreadPool<std::pair<std::vector<T>, size_t>, std::pair<std::vector<entry_np>, size_t>> L_read_1(
@@ -85,97 +60,61 @@ void compute_stage1(int L_index, int num_threads,
 	
 	typedef DiskSortLP::WriteCache WriteCache;
 	
-	ThreadPool<std::vector<entry_kpp>, size_t, std::shared_ptr<WriteCache>> R_add_2(
-		[R_sort_2, &R_num_write]
-		 (std::vector<entry_kpp>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
+	ThreadPool<std::pair<std::vector<entry_kpp>, uint64_t>, size_t, std::shared_ptr<WriteCache>> R_add_2(
+		[R_sort_2, &R_num_write, &L_window]
+		 (std::pair<std::vector<entry_kpp>, uint64_t>& input, size_t&, std::shared_ptr<WriteCache>& cache) {
+			// all previous merge jobs are done, later ones start at this position or above
+			L_window.set_floor(input.second);
 			if(!cache) {
 				cache = R_sort_2->add_cache();
 			}
-			for(auto& entry : input) {
+			for(auto& entry : input.first) {
 				entry_lp tmp;
 				tmp.key = entry.key;
 				tmp.point = Encoding::SquareToLinePoint(entry.pos[0], entry.pos[1]);
 				cache->add(tmp);
 			}
-			R_num_write += input.size();
+			R_num_write += input.first.size();
 		}, nullptr, std::max(num_threads / 2, 1), "phase3/add");
 	
-	ThreadPool<std::pair<std::vector<S>, size_t>, std::vector<entry_kpp>, merge_buffer_t> R_read(
-		[&mutex, &signal, &signal_1, &L_input, &L_is_end] (
+	ThreadPool<std::pair<std::vector<S>, size_t>, std::pair<std::vector<entry_kpp>, uint64_t>, uint64_t> R_read(
+		[&L_window] (
 			std::pair<std::vector<S>, size_t>& input,
-			std::vector<entry_kpp>& out,
-			merge_buffer_t& L_buffer)
+			std::pair<std::vector<entry_kpp>, uint64_t>& out,
+			uint64_t& L_position)
 		{
-			out.reserve(input.first.size());
-			uint64_t L_position = 0;
+			out.first.reserve(input.first.size());
 			for(const auto& entry : input.first) {
 				uint64_t pos[2];
 				pos[0] = entry.pos;
 				pos[1] = uint64_t(entry.pos) + entry.off;
-				if(pos[0] < L_buffer.offset) {
+				if(pos[0] < L_position) {
 					throw std::logic_error("input not sorted");
 				}
 				L_position = pos[0];
-				pos[0] -= L_buffer.offset;
-				pos[1] -= L_buffer.offset;
 				
-				while(L_buffer.new_pos.size() <= pos[1]) {
-					{
-						std::unique_lock<std::mutex> lock(mutex);
-						while(true) {
-							bool do_wait = true;
-							for(auto& buffer : L_input) {
-								if(buffer.offset >= L_buffer.offset + L_buffer.new_pos.size()) {
-									L_buffer.new_pos.insert(L_buffer.new_pos.end(),
-															buffer.new_pos.begin(), buffer.new_pos.end());
-									buffer.copy_sync++;
-									do_wait = false;
-								}
-							}
-							if(do_wait && !L_is_end) {
-								signal.wait(lock);		// wait for new input
-							} else {
-								break;
-							}
-						}
-					}
-					signal_1.notify_all();	// notify copy_sync change
-					if(L_is_end) {
-						break;
-					}
-				}
-				if(std::max(pos[0], pos[1]) >= L_buffer.new_pos.size()) {
-					throw std::logic_error("position out of bounds (" + std::to_string(L_buffer.offset)
-						+ " + max(" + std::to_string(pos[0]) + "," + std::to_string(pos[1]) + "))");
+				if(!L_window.wait(std::max(pos[0], pos[1]))) {
+					throw std::logic_error("position out of bounds (max(" + std::to_string(pos[0])
+						+ "," + std::to_string(pos[1]) + ") >= " + std::to_string(L_window.size()) + ")");
 				}
 				entry_kpp tmp;
 				tmp.key = get_sort_key<S>{}(entry);
-				tmp.pos[0] = L_buffer.new_pos[pos[0]];
-				tmp.pos[1] = L_buffer.new_pos[pos[1]];
-				out.push_back(tmp);
-			}
-			if(L_position > L_buffer.offset) {
-				// delete old data
-				const auto count = std::min<uint64_t>(	L_position - L_buffer.offset,
-														L_buffer.new_pos.size());
-				L_buffer.offset += count;
-				L_buffer.new_pos.erase(L_buffer.new_pos.begin(), L_buffer.new_pos.begin() + count);
+				tmp.pos[0] = L_window[pos[0]];
+				tmp.pos[1] = L_window[pos[1]];
+				out.first.push_back(tmp);
 			}
+			out.second = L_position;
 		}, &R_add_2, num_threads_merge, "phase3/merge");
 	
-	std::thread R_sort_read(
-		[&mutex, &signal_1, num_threads, L_table, R_sort, R_table, &R_read, &R_is_end]() {
+	const auto R_sort_read = ThreadCache::instance().run(
+		[num_threads, L_table, R_sort, R_table, &R_read, &L_window]() {
 			if(R_table) {
 				R_table->read(&R_read, std::max(num_threads / 4, 2));
 			} else {
 				R_sort->read(&R_read, std::max(num_threads / (L_table ? 1 : 2), 1));
 			}
 			R_read.close();
-			{
-				std::lock_guard<std::mutex> lock(mutex);
-				R_is_end = true;
-				signal_1.notify_all();
-			}
+			L_window.set_floor(-1);		// no more readers
 		});
 	
 	if(L_table) {
@@ -185,12 +124,9 @@ void compute_stage1(int L_index, int num_threads,
 		L_sort->read(&L_read, std::max(num_threads / (R_table ? 1 : 2), 1));
 	}
 	L_read.close();
-	{
-		std::lock_guard<std::mutex> lock(mutex);
-		L_is_end = true;
-		signal.notify_all();
-	}
-	R_sort_read.join();
+	L_window.close();
+	
+	R_sort_read->wait();
 	R_add_2.close();
 	
 	R_sort_2->finish();
@@ -225,7 +161,7 @@ static uint32_t CalculateParkSize(uint8_t k, uint8_t table_index)
 
 // Writes the plot file header to a file
 uint32_t WriteHeader(
-	FILE* file,
+	PlotFile* file,
 	uint8_t k,
 	const uint8_t* id,
 	const uint8_t* memo,
@@ -241,26 +177,24 @@ uint32_t WriteHeader(
 
 	const std::string header_text = "Proof of Space Plot";
 	
-	size_t num_bytes = 0;
-	num_bytes += fwrite(header_text.c_str(), 1, header_text.size(), file);
-	num_bytes += fwrite((id), 1, kIdLen, file);
-
-	uint8_t k_buffer[1] = {k};
-	num_bytes += fwrite((k_buffer), 1, 1, file);
+	std::vector<uint8_t> header;
+	header.insert(header.end(), header_text.begin(), header_text.end());
+	header.insert(header.end(), id, id + kIdLen);
+	header.push_back(k);
 
 	uint8_t size_buffer[2];
 	Util::IntToTwoBytes(size_buffer, kFormatDescription.size());
-	num_bytes += fwrite((size_buffer), 1, 2, file);
-	num_bytes += fwrite(kFormatDescription.c_str(), 1, kFormatDescription.size(), file);
+	header.insert(header.end(), size_buffer, size_buffer + 2);
+	header.insert(header.end(), kFormatDescription.begin(), kFormatDescription.end());
 
 	Util::IntToTwoBytes(size_buffer, memo_len);
-	num_bytes += fwrite((size_buffer), 1, 2, file);
-	num_bytes += fwrite((memo), 1, memo_len, file);
+	header.insert(header.end(), size_buffer, size_buffer + 2);
+	header.insert(header.end(), memo, memo + memo_len);
 
-	uint8_t pointers[10 * 8] = {};
-	num_bytes += fwrite((pointers), 8, 10, file) * 8;
+	// 10 table pointers, written at the end
+	header.resize(header.size() + 10 * 8);
 
-	fflush(file);
+	const size_t num_bytes = file->write_at(0, header.data(), header.size());
 	std::cout << "Wrote plot header with " << num_bytes << " bytes" << std::endl;
 	return num_bytes;
 }
@@ -321,29 +255,150 @@ void WritePark(
     memset(index, 0x00, park_buffer_size - (index - park_buffer));
 }
 
+// Same output as WritePark(), computed directly from the sorted line points.
+// The delta loop is free of branches so it can be vectorized, stubs are packed
+// by a 64-bit big-endian bit writer straight into park_buffer.
+inline
+void EncodePark(
+	const uintlp_t* points,
+	const size_t num_points,
+	uint8_t k,
+	uint8_t table_index,
+	uint8_t* park_buffer,
+	const uint64_t park_buffer_size)
+{
+	const int stub_size = k - kStubMinusBits;
+	const uint64_t stub_mask = (uint64_t(1) << stub_size) - 1;
+	const uint32_t line_point_size = CalculateLinePointSize(k);
+	const uint32_t stubs_size = CalculateStubsSize(k);
+	
+	if(num_points < 1 || num_points > kEntriesPerPark) {
+		throw std::logic_error("invalid park size: " + std::to_string(num_points));
+	}
+	if(park_buffer_size < line_point_size + stubs_size + 16) {
+		throw std::logic_error("park buffer too small");
+	}
+	const size_t num_deltas = num_points - 1;
+	
+	uint8_t deltas[kEntriesPerPark];
+	uint32_t stubs[kEntriesPerPark];
+	uint64_t overflow = 0;
+	for(size_t i = 0; i < num_deltas; ++i) {
+		const auto big_delta = points[i + 1] - points[i];
+		const auto small_delta = big_delta >> stub_size;
+		stubs[i] = uint64_t(big_delta) & stub_mask;
+		deltas[i] = small_delta;
+		overflow |= uint64_t(small_delta >> 8);
+	}
+	if(overflow) {
+		for(size_t i = 0; i < num_deltas; ++i) {
+			const auto small_delta = (points[i + 1] - points[i]) >> stub_size;
+			if(small_delta >= 256) {
+				throw std::logic_error("small_delta >= 256 (" + std::to_string(uint64_t(small_delta)) + ")");
+			}
+		}
+	}
+	uint8_t* index = park_buffer;
+	
+	Util::IntTo16Bytes(index, uint128_t(points[0]) << (128 - 2 * k));
+	index += line_point_size;
+	
+	// Stubs are written left aligned, 8 bytes at a time. Bytes past the current
+	// position are overwritten by the next store, or zeroed / replaced below.
+	{
+		uint8_t* out = index;
+		uint64_t buffer = 0;
+		int num_bits = 0;
+		for(size_t i = 0; i < num_deltas; ++i) {
+			buffer |= uint64_t(stubs[i]) << (64 - stub_size - num_bits);
+			num_bits += stub_size;
+			const uint64_t tmp = bswap_64(buffer);
+			memcpy(out, &tmp, 8);
+			const int num_bytes = num_bits >> 3;
+			out += num_bytes;
+			buffer <<= num_bytes * 8;
+			num_bits &= 7;
+		}
+		const uint64_t tmp = bswap_64(buffer);
+		memcpy(out, &tmp, 8);
+		out += (num_bits + 7) >> 3;
+		memset(out, 0, stubs_size - (out - index));
+	}
+	index += stubs_size;
+	
+	uint8_t* deltas_start = index + 2;
+	size_t deltas_size = Encoding::ANSEncode(table_index - 1, deltas, num_deltas, deltas_start);
+	
+	if(!deltas_size) {
+		// Uncompressed
+		deltas_size = num_deltas;
+		Util::IntToTwoBytesLE(index, deltas_size | 0x8000);
+		memcpy(deltas_start, deltas, deltas_size);
+	} else {
+		// Compressed
+		Util::IntToTwoBytesLE(index, deltas_size);
+	}
+	index += 2 + deltas_size;
+	
+	if(uint64_t(index - park_buffer) > park_buffer_size) {
+		throw std::logic_error(
+			"Overflowed park buffer, writing " + std::to_string(index - park_buffer) +
+			" bytes. Space: " + std::to_string(park_buffer_size));
+	}
+	memset(index, 0, park_buffer_size - (index - park_buffer));
+}
+
+struct park_data_t {
+	int L_index = 0;
+	uint64_t offset = 0;				// in plot file
+	std::vector<uintlp_t> points;
+};
+
+struct park_out_t {
+	uint64_t offset = 0;
+	std::vector<uint8_t> buffer;
+};
+
+inline
+void encode_parks(const int k, const std::vector<park_data_t>& input, std::vector<park_out_t>& out)
+{
+	for(const auto& park : input) {
+		park_out_t tmp;
+		tmp.offset = park.offset;
+		tmp.buffer.resize(CalculateParkSize(k, park.L_index));
+		EncodePark(
+			park.points.data(),
+			park.points.size(),
+			k,
+			park.L_index,
+			tmp.buffer.data(),
+			tmp.buffer.size());
+		out.emplace_back(std::move(tmp));
+	}
+}
+
+/*
+ * Parks are passed on to park_out, they are encoded and written in the background,
+ * while the next table is being processed already.
+ */
 inline
 uint64_t compute_stage2(int L_index, int k, int num_threads,
 						DiskSortLP* R_sort, DiskSortNP* L_sort,
-						FILE* plot_file, uint64_t L_final_begin, uint64_t* R_final_begin)
+						Processor<std::vector<park_data_t>>* park_out,
+						uint64_t L_final_begin, uint64_t* R_final_begin)
 {
 	const auto begin = get_wall_time_micros();
 	
 	std::atomic<uint64_t> R_num_read {0};
 	std::atomic<uint64_t> L_num_write {0};
-	std::atomic<uint64_t> num_written_final {0};
-	
-	struct park_data_t {
-		uint64_t index = 0;
-		std::vector<uintlp_t> points;
-	} park;
-	
-	struct park_out_t {
-		uint64_t offset = 0;
-		std::vector<uint8_t> buffer;
-	};
+	uint64_t num_written_final = 0;
 	
 	const auto park_size_bytes = CalculateParkSize(k, L_index);
 	
+	park_data_t park;
+	park.L_index = L_index;
+	park.offset = L_final_begin;
+	
 	typedef DiskSortNP::WriteCache WriteCache;
 	
 	ThreadPool<std::pair<std::vector<entry_lp>, size_t>, size_t, std::shared_ptr<WriteCache>> L_add(
@@ -365,94 +420,46 @@ uint64_t compute_stage2(int L_index, int k, int num_threads,
 			L_num_write += index - input.second;
 		}, nullptr, std::max(num_threads / 2, 1), "phase3/add");
 	
-	Thread<std::vector<park_out_t>> park_write(
-		[plot_file](std::vector<park_out_t>& input) {
-			for(const auto& park : input) {
-				fwrite_at(plot_file, park.offset, park.buffer.data(), park.buffer.size());
-			}
-		}, "phase3/write");
-	
-	ThreadPool<std::vector<park_data_t>, std::vector<park_out_t>> park_threads(
-		[L_index, k, L_final_begin, park_size_bytes, &num_written_final]
-		 (std::vector<park_data_t>& input, std::vector<park_out_t>& out, size_t&) {
-			for(const auto& park : input) {
-				const auto& points = park.points;
-				if(points.empty()) {
-					throw std::logic_error("empty park input");
-				}
-				std::vector<uint8_t> deltas(points.size() - 1);
-				ParkBits stub_bits;
-				for(size_t i = 0; i < points.size() - 1; ++i) {
-					const auto big_delta = points[i + 1] - points[i];
-					const auto stub = big_delta & ((1ull << (k - kStubMinusBits)) - 1);
-					const auto small_delta = big_delta >> (k - kStubMinusBits);
-					if(small_delta >= 256) {
-						throw std::logic_error("small_delta >= 256 (" + std::to_string(uint64_t(small_delta)) + ")");
-					}
-					deltas[i] = small_delta;
-					stub_bits.AppendValue(stub, (k - kStubMinusBits));
-				}
-				park_out_t tmp;
-				tmp.offset = L_final_begin + park.index * park_size_bytes;
-				tmp.buffer.resize(park_size_bytes);
-				WritePark(
-					points[0],
-					deltas,
-					stub_bits,
-					k,
-					L_index,
-					tmp.buffer.data(),
-					tmp.buffer.size());
-				out.emplace_back(std::move(tmp));
-				num_written_final += points.size();
+	for(auto& input : R_sort->blocks(num_threads))
+	{
+		std::vector<park_data_t> parks;
+		parks.reserve(input.first.size() / kEntriesPerPark + 2);
+		uint64_t index = input.second;
+		for(const auto& entry : input.first) {
+			if(index >= uint64_t(1) << PMAX) {
+				break;	// skip PMAX-bit overflow
 			}
-		}, &park_write, std::max(num_threads / 2, 1), "phase3/park");
-	
-	Thread<std::pair<std::vector<entry_lp>, size_t>> R_read(
-		[&R_num_read, &L_add, &park, &park_threads](std::pair<std::vector<entry_lp>, size_t>& input) {
-			std::vector<park_data_t> parks;
-			parks.reserve(input.first.size() / kEntriesPerPark + 2);
-			uint64_t index = input.second;
-			for(const auto& entry : input.first) {
-				if(index >= uint64_t(1) << PMAX) {
-					break;	// skip PMAX-bit overflow
+			// Every EPP entries, writes a park
+			if(index % kEntriesPerPark == 0) {
+				if(index != 0) {
+					parks.emplace_back(std::move(park));
+					park.offset += park_size_bytes;
 				}
-				// Every EPP entries, writes a park
-				if(index % kEntriesPerPark == 0) {
-					if(index != 0) {
-						parks.emplace_back(std::move(park));
-						park.index++;
-					}
-					park.points.clear();
-					park.points.reserve(kEntriesPerPark);
-				}
-				park.points.push_back(entry.point);
-				index++;
+				park.points.clear();
+				park.points.reserve(kEntriesPerPark);
 			}
-			R_num_read += input.first.size();
-			park_threads.take(parks);
-			L_add.take(input);
-		}, "phase3/slice");
-	
-	R_sort->read(&R_read, num_threads);
-	R_read.close();
+			park.points.push_back(entry.point);
+			index++;
+		}
+		R_num_read += input.first.size();
+		num_written_final += index - input.second;
+		park_out->take(parks);
+		L_add.take(input);
+	}
 	
 	// Since we don't have a perfect multiple of EPP entries, this writes the last ones
 	if(!park.points.empty()) {
 		std::vector<park_data_t> parks{park};
-		park_threads.take(parks);
-		park.index++;
+		park_out->take(parks);
+		park.offset += park_size_bytes;
 	}
-	park_threads.close();
-	park_write.close();
 	L_add.close();
 	
 	L_sort->finish();
 	
 	if(R_final_begin) {
-		*R_final_begin = L_final_begin + park.index * park_size_bytes;
+		*R_final_begin = park.offset;
 	}
-	Encoding::ANSFree(kRValues[L_index - 1]);
 	
 	if(L_num_write < R_num_read) {
 //		std::cout << "[P3-2] Lost " << R_num_read - L_num_write << " entries due to PMAX-bit overflow." << std::endl;
@@ -470,7 +477,8 @@ void compute(	phase2::output_t& input, output_t& out,
 				const std::string plot_name,
 				const std::string tmp_dir,
 				const std::string tmp_dir_2,
-				const std::string plot_dir)
+				const std::string plot_dir,
+				const bool stream = false)
 {
 	const auto total_begin = get_wall_time_micros();
 	
@@ -480,11 +488,11 @@ void compute(	phase2::output_t& input, output_t& out,
 	out.params = input.params;
 	out.plot_file_name = plot_dir + plot_name + ".plot.tmp";
 	
-	FILE* plot_file = fopen(out.plot_file_name.c_str(), "wb");
-	if(!plot_file) {
-		throw std::runtime_error("fopen() failed with: " + std::string(std::strerror(errno)));
-	}
-	out.header_size = WriteHeader(	plot_file, k, input.params.id.data(),
+	// in stream mode the plot is written sequentially
+	out.plot_file = std::make_shared<PlotFile>(out.plot_file_name, true, stream);
+	auto& plot_file = *out.plot_file;
+	
+	out.header_size = WriteHeader(	&plot_file, k, input.params.id.data(),
 									input.params.memo.data(), input.params.memo.size());
 	
 	std::vector<uint64_t> final_pointers(8, 0);
@@ -492,10 +500,25 @@ void compute(	phase2::output_t& input, output_t& out,
 	
 	uint64_t num_written_final = 0;
 	
+	ThreadPool<std::vector<park_data_t>, size_t> park_threads(
+		[k, &plot_file](std::vector<park_data_t>& input, size_t&, size_t&) {
+			try {
+				std::vector<park_out_t> out;
+				encode_parks(k, input, out);
+				plot_file.write_all(out);
+			} catch(const std::exception& ex) {
+				plot_file.abort(ex.what());		// don't leave other writers waiting for our parks
+				throw;
+			}
+		}, nullptr, std::max(num_threads / 2, 1), "phase3/park");
+	
+	const int log_num_buckets_lp = get_log_num_buckets<entry_lp>(log_num_buckets, k, num_threads, "[P3-1]");
+	const int log_num_buckets_np = get_log_num_buckets<entry_np>(log_num_buckets, k, num_threads, "[P3-2]");
+	
 	DiskTable<phase2::entry_1> L_table_1(input.table_1);
 	
 	auto R_sort_lp = std::make_shared<DiskSortLP>(
-			2 * k - 1, log_num_buckets, prefix_2 + "p3s1.t2");
+			2 * k - 1, log_num_buckets_lp, prefix_2 + "p3s1.t2");
 	
 	compute_stage1<phase2::entry_1, phase2::entry_x, DiskSortNP, phase2::DiskSortT>(
 			1, num_threads, nullptr, input.sort[1].get(), R_sort_lp.get(), &L_table_1, input.bitfield_1.get());
@@ -504,56 +527,53 @@ void compute(	phase2::output_t& input, output_t& out,
 	remove(input.table_1.file_name);
 	
 	auto L_sort_np = std::make_shared<DiskSortNP>(
-			k, log_num_buckets, prefix_2 + "p3s2.t2");
+			k, log_num_buckets_np, prefix_2 + "p3s2.t2");
 	
 	num_written_final += compute_stage2(
 			1, k, num_threads, R_sort_lp.get(), L_sort_np.get(),
-			plot_file, final_pointers[1], &final_pointers[2]);
+			&park_threads, final_pointers[1], &final_pointers[2]);
 	
 	for(int L_index = 2; L_index < 6; ++L_index)
 	{
 		const std::string R_t = "t" + std::to_string(L_index + 1);
 		
 		R_sort_lp = std::make_shared<DiskSortLP>(
-				2 * k - 1, log_num_buckets, prefix_2 + "p3s1." + R_t);
+				2 * k - 1, log_num_buckets_lp, prefix_2 + "p3s1." + R_t);
 		
 		compute_stage1<entry_np, phase2::entry_x, DiskSortNP, phase2::DiskSortT>(
 				L_index, num_threads, L_sort_np.get(), input.sort[L_index].get(), R_sort_lp.get());
 		
 		L_sort_np = std::make_shared<DiskSortNP>(
-				k, log_num_buckets, prefix_2 + "p3s2." + R_t);
+				k, log_num_buckets_np, prefix_2 + "p3s2." + R_t);
 		
 		num_written_final += compute_stage2(
 				L_index, k, num_threads, R_sort_lp.get(), L_sort_np.get(),
-				plot_file, final_pointers[L_index], &final_pointers[L_index + 1]);
+				&park_threads, final_pointers[L_index], &final_pointers[L_index + 1]);
 	}
 	
 	DiskTable<phase2::entry_7> R_table_7(input.table_7);
 	
-	R_sort_lp = std::make_shared<DiskSortLP>(2 * k - 1, log_num_buckets, prefix_2 + "p3s1.t7");
+	R_sort_lp = std::make_shared<DiskSortLP>(2 * k - 1, log_num_buckets_lp, prefix_2 + "p3s1.t7");
 	
 	compute_stage1<entry_np, phase2::entry_7, DiskSortNP, phase2::DiskSort7>(
 			6, num_threads, L_sort_np.get(), nullptr, R_sort_lp.get(), nullptr, nullptr, &R_table_7);
 	
 	remove(input.table_7.file_name);
 	
-	L_sort_np = std::make_shared<DiskSortNP>(k, log_num_buckets, prefix_2 + "p3s2.t7");
+	L_sort_np = std::make_shared<DiskSortNP>(k, log_num_buckets_np, prefix_2 + "p3s2.t7");
 	
 	const auto num_written_final_7 = compute_stage2(
 			6, k, num_threads, R_sort_lp.get(), L_sort_np.get(),
-			plot_file, final_pointers[6], &final_pointers[7]);
+			&park_threads, final_pointers[6], &final_pointers[7]);
 	num_written_final += num_written_final_7;
 	
-	fseek_set(plot_file, out.header_size - 10 * 8);
+	park_threads.close();
+	
 	for(size_t i = 1; i < final_pointers.size(); ++i) {
 		uint8_t tmp[8] = {};
 		Util::IntToEightBytes(tmp, final_pointers[i]);
-		fwrite_ex(plot_file, tmp, sizeof(tmp));
-	}
-	if(fclose(plot_file)) {
-		throw std::runtime_error("fclose() failed with: " + std::string(std::strerror(errno)));
+		plot_file.write_at(out.header_size - 10 * 8 + (i - 1) * 8, tmp, sizeof(tmp));
 	}
-	plot_file = nullptr;
 	
 	out.sort_7 = L_sort_np;
 	out.num_written_7 = num_written_final_7;
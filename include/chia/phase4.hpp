@@ -10,6 +10,9 @@
 
 #include <chia/encoding.hpp>
 #include <chia/util.hpp>
+#include <chia/PlotFile.h>
+
+#include <numeric>
 
 
 namespace phase4 {
@@ -26,6 +29,29 @@ static uint32_t CalculateC3Size(uint8_t k)
 	}
 }
 
+// Copies a whole file to plot_file at offset
+inline
+void append_file(PlotFile* plot_file, uint64_t offset, const std::string& file_name)
+{
+	FILE* file = fopen(file_name.c_str(), "rb");
+	if(!file) {
+		throw std::runtime_error("fopen() failed for " + file_name + " (" + std::string(std::strerror(errno)) + ")");
+	}
+	std::vector<uint8_t> buffer(16 << 20);
+	while(true) {
+		const auto num_bytes = fread(buffer.data(), 1, buffer.size(), file);
+		offset += plot_file->write_at(offset, buffer.data(), num_bytes);
+		if(num_bytes < buffer.size()) {
+			break;
+		}
+	}
+	const bool failed = ferror(file);
+	fclose(file);
+	if(failed) {
+		throw std::runtime_error("fread() failed for " + file_name);
+	}
+}
+
 // Writes the checkpoint tables. The purpose of these tables, is to store a list of ~2^k values
 // of size k (the proof of space outputs from table 7), in a way where they can be looked up for
 // proofs, but also efficiently. To do this, we assume table 7 is sorted by f7, and we write the
@@ -42,11 +68,15 @@ static uint32_t CalculateC3Size(uint8_t k)
 // C1 (checkpoint values)
 // C2 (checkpoint values into)
 // C3 (deltas of f7s between C1 checkpoints)
-uint64_t compute(	FILE* plot_file,
+//
+// If plot_file is in stream mode, C3 is written to spill_file_name first, and then
+// appended after C2, so that the plot is written in ascending order.
+uint64_t compute(	PlotFile* plot_file,
 					const uint8_t k, const int header_size,
 					phase3::DiskSortNP* L_sort_7, int num_threads,
 					const uint64_t final_pointer_7,
-					const uint64_t final_entries_written)
+					const uint64_t final_entries_written,
+					const std::string& spill_file_name = std::string())
 {
 	const uint32_t P7_park_size = Util::ByteAlign((k + 1) * kEntriesPerPark) / 8;
     const uint64_t number_of_p7_parks =
@@ -70,172 +100,161 @@ uint64_t compute(	FILE* plot_file,
     final_table_begin_pointers[10] = begin_byte_C3;
     final_table_begin_pointers[11] = end_byte;
 
-    uint64_t final_file_writer_1 = begin_byte_C1;
-    uint64_t final_file_writer_3 = final_table_begin_pointers[7];
+    const uint32_t C1_entry_size = Util::ByteAlign(k) / 8;
 
-    uint64_t prev_y = 0;
-    uint64_t num_C1_entries = 0;
-    
     std::vector<uintkx_t> C2;
+    
+    // C1 is small, it's written together with C2 at the end
+    std::vector<uint8_t> C1_table(total_C1_entries * C1_entry_size);
+    
+    std::unique_ptr<PlotFile> C3_spill;
+    PlotFile* C3_file = plot_file;
+    uint64_t C3_offset = begin_byte_C3;
+    if(plot_file->is_stream()) {
+    	C3_spill = std::make_unique<PlotFile>(
+    			spill_file_name.empty() ? plot_file->get_file_name() + ".c3" : spill_file_name, true);
+    	C3_file = C3_spill.get();
+    	C3_offset = 0;
+    }
 
     std::cout << "[P4] Starting to write C1 and C3 tables" << std::endl;
     
-	struct park_deltas_t {
-		uint64_t offset = 0;
-		std::vector<uint8_t> deltas;
-	} park_deltas;
+	// All outputs depend only on the global index, so table 7 is split into ranges
+	// which are a multiple of kEntriesPerPark and kCheckpoint1Interval, and
+	// every range is processed independently.
+	const uint64_t range_size = std::lcm(uint64_t(kEntriesPerPark), uint64_t(kCheckpoint1Interval));
 	
-	struct park_data_t {
-		uint64_t offset = 0;
-		std::vector<uintkx_t> array;	// new_pos
-	} park_data;
+	struct range_t {
+		uint64_t index = 0;						// global index of first entry
+		std::vector<phase3::entry_np> entries;
+	} range;
 	
-    struct write_data_t {
-		uint64_t offset = 0;
-		std::vector<uint8_t> buffer;
-	};
-    
-    Thread<std::vector<write_data_t>> plot_write(
-		[plot_file](std::vector<write_data_t>& input) {
-			for(const auto& write : input) {
-				fwrite_at(plot_file, write.offset, write.buffer.data(), write.buffer.size());
-			}
-		}, "phase4/write");
-    
-    ThreadPool<std::vector<park_data_t>, std::vector<write_data_t>> p7_threads(
-		[k, P7_park_size](std::vector<park_data_t>& input, std::vector<write_data_t>& out, size_t&) {
-			for(const auto& park : input) {
-				write_data_t tmp;
-				tmp.offset = park.offset;
-				tmp.buffer.resize(P7_park_size);
-				ParkBits bits;
-				for(uint64_t new_pos : park.array) {
-					bits += ParkBits(new_pos, k + 1);
+	ThreadPool<range_t, size_t> range_threads(
+		[plot_file, k, final_pointer_7, P7_park_size, C3_file, C3_offset, C3_size, C1_entry_size, &C1_table]
+		 (range_t& range, size_t&, size_t&) {
+			try {
+				const auto& entries = range.entries;
+				
+				// P7 parks
+				std::vector<uint8_t> P7_buffer;
+				for(size_t i = 0; i < entries.size(); i += kEntriesPerPark) {
+					ParkBits bits;
+					for(size_t j = i; j < std::min<size_t>(i + kEntriesPerPark, entries.size()); ++j) {
+						bits += ParkBits(entries[j].pos, k + 1);
+					}
+					P7_buffer.resize(P7_buffer.size() + P7_park_size);
+					bits.ToBytes(P7_buffer.data() + P7_buffer.size() - P7_park_size);
 				}
-				bits.ToBytes(tmp.buffer.data());
-				out.emplace_back(std::move(tmp));
-    		}
-		}, &plot_write, std::max(num_threads / 2, 1), "phase4/P7");
-    
-	ThreadPool<park_deltas_t, std::vector<write_data_t>> park_threads(
-		[C3_size](park_deltas_t& park, std::vector<write_data_t>& out, size_t&) {
-			write_data_t tmp;
-			tmp.offset = park.offset;
-			tmp.buffer.resize(C3_size);
-			const size_t num_bytes =
-					Encoding::ANSEncodeDeltas(park.deltas, kC3R, tmp.buffer.data() + 2);
-			
-			if(num_bytes + 2 > C3_size) {
-				throw std::logic_error("C3 overflow");
-			}
-			Util::IntToTwoBytes(tmp.buffer.data(), num_bytes);	// Write the size
-			out.emplace_back(std::move(tmp));
-		}, &plot_write, std::max(num_threads / 2, 1), "phase4/C3");
-
-    // We read each table7 entry, which is sorted by f7, but we don't need f7 anymore. Instead,
-	// we will just store pos6, and the deltas in table C3, and checkpoints in tables C1 and C2.
-    Thread<std::pair<std::vector<phase3::entry_np>, size_t>> read_thread(
-	[k, begin_byte_C3, C3_size, P7_park_size, &num_C1_entries, &prev_y, &C2,
-	 &park_deltas, &park_data, &park_threads, &p7_threads, &plot_write,
-	 &final_file_writer_1, &final_file_writer_3]
-	 (std::pair<std::vector<phase3::entry_np>, size_t>& input) {
-		std::vector<park_data_t> parks;
-		parks.reserve(input.first.size() / kEntriesPerPark + 2);
-		uint64_t index = input.second;
-		for(const auto& entry : input.first) {
-			const uint64_t entry_y = entry.key;
-	
-			if(index % kEntriesPerPark == 0 && index > 0)
-			{
-				park_data.offset = final_file_writer_3;
-				final_file_writer_3 += P7_park_size;
+				plot_file->write_at(final_pointer_7 + (range.index / kEntriesPerPark) * P7_park_size,
+									P7_buffer.data(), P7_buffer.size());
 				
-				parks.emplace_back(std::move(park_data));
+				// C1 checkpoints and C3 deltas
+				std::vector<uint8_t> C3_buffer(C3_size);
+				std::vector<uint8_t> deltas;
+				deltas.reserve(kCheckpoint1Interval);
 				
-				park_data.array.clear();
-				park_data.array.reserve(kEntriesPerPark);
-			}
-			park_data.array.push_back(entry.pos);
-	
-			if(index % kCheckpoint1Interval == 0)
-			{
-				write_data_t out;
-				out.offset = final_file_writer_1;
-				out.buffer.resize(Util::ByteAlign(k) / 8);
-				Bits(entry_y, k).ToBytes(out.buffer.data());
-				final_file_writer_1 += out.buffer.size();
+				for(size_t i = 0; i < entries.size(); i += kCheckpoint1Interval)
 				{
-					std::vector<write_data_t> out_;
-					out_.emplace_back(std::move(out));
-					plot_write.take(out_);
+					const auto end = std::min<size_t>(i + kCheckpoint1Interval, entries.size());
+					
+					const auto C1_index = (range.index + i) / kCheckpoint1Interval;
+					Bits(entries[i].key, k).ToBytes(C1_table.data() + C1_index * C1_entry_size);
+					
+					deltas.clear();
+					for(size_t j = i + 1; j < end; ++j) {
+						deltas.push_back(entries[j].key - entries[j - 1].key);
+					}
+					if(deltas.empty()) {
+						continue;
+					}
+					std::fill(C3_buffer.begin(), C3_buffer.end(), 0);
+					const size_t num_bytes =
+							Encoding::ANSEncode(kANSTableC3, deltas.data(), deltas.size(), C3_buffer.data() + 2);
+					
+					if(num_bytes + 2 > C3_size) {
+						throw std::logic_error("C3 overflow");
+					}
+					Util::IntToTwoBytes(C3_buffer.data(), num_bytes);	// Write the size
+					
+					C3_file->write_at(C3_offset + C1_index * C3_size, C3_buffer.data(), C3_buffer.size());
 				}
-				if(num_C1_entries > 0) {
-					park_deltas.offset = begin_byte_C3 + (num_C1_entries - 1) * C3_size;
-					park_threads.take(park_deltas);
-				}
-				if(index % (kCheckpoint1Interval * kCheckpoint2Interval) == 0) {
-					C2.push_back(entry_y);
-				}
-				park_deltas.deltas.clear();
-				park_deltas.deltas.reserve(kCheckpoint1Interval);
-				num_C1_entries++;
+			} catch(const std::exception& ex) {
+				C3_file->abort(ex.what());
+				plot_file->abort(ex.what());	// don't leave other writers waiting for our parks
+				throw;
 			}
-			else {
-				park_deltas.deltas.push_back(entry_y - prev_y);
+		}, nullptr, std::max(num_threads, 1), "phase4/range");
+	
+    // We read each table7 entry, which is sorted by f7, but we don't need f7 anymore. Instead,
+	// we will just store pos6, and the deltas in table C3, and checkpoints in tables C1 and C2.
+    range.entries.reserve(range_size);
+    for(const auto& input : L_sort_7->blocks(num_threads))
+    {
+		const auto& entries = input.first;
+		const uint64_t index = input.second;
+		if(index != range.index + range.entries.size()) {
+			throw std::logic_error("phase4: input not contiguous");
+		}
+		const uint64_t C2_interval = uint64_t(kCheckpoint1Interval) * kCheckpoint2Interval;
+		for(uint64_t i = cdiv(index, C2_interval) * C2_interval; i < index + entries.size(); i += C2_interval) {
+			C2.push_back(entries[i - index].key);
+		}
+		for(size_t i = 0; i < entries.size();)
+		{
+			const size_t count = std::min<size_t>(range_size - range.entries.size(), entries.size() - i);
+			range.entries.insert(range.entries.end(), entries.begin() + i, entries.begin() + i + count);
+			i += count;
+			if(range.entries.size() == range_size) {
+				const auto next = range.index + range_size;
+				range_threads.take(range);
+				range = range_t();
+				range.index = next;
+				range.entries.reserve(range_size);
 			}
-			prev_y = entry_y;
-			index++;
 		}
-		p7_threads.take(parks);
-	}, "phase4/read");
-    
-    L_sort_7->read(&read_thread, num_threads);
-    read_thread.close();
-    
-    park_data.offset = final_file_writer_3;
-    {
-		std::vector<park_data_t> parks{park_data};
-		p7_threads.take(parks);
     }
-    final_file_writer_3 += P7_park_size;
-
-    if(!park_deltas.deltas.empty()) {
-    	park_deltas.offset = begin_byte_C3 + (num_C1_entries - 1) * C3_size;
-		park_threads.take(park_deltas);
+    
+    const uint64_t num_entries = range.index + range.entries.size();
+    if(!range.entries.empty()) {
+		range_threads.take(range);
     }
-    Encoding::ANSFree(kC3R);
+    range_threads.close();
     
-    park_threads.close();
-    p7_threads.close();
-    plot_write.close();
-
-    uint8_t C1_entry_buf[8] = {};
-    Bits(0, Util::ByteAlign(k)).ToBytes(C1_entry_buf);
-    final_file_writer_1 +=
-    		fwrite_at(plot_file, final_file_writer_1, C1_entry_buf, Util::ByteAlign(k) / 8);
+    const auto num_C1_entries = cdiv(num_entries, kCheckpoint1Interval);
+    if(num_C1_entries != total_C1_entries) {
+    	throw std::logic_error("phase4: C1 entry count mismatch");
+    }
+    // C1 entries, followed by a zero entry
+    C1_table.resize(C1_table.size() + C1_entry_size);
     
     std::cout << "[P4] Finished writing C1 and C3 tables" << std::endl;
     std::cout << "[P4] Writing C2 table" << std::endl;
-
+    
+    // C2 entries, followed by a zero entry
     for(auto C2_entry : C2) {
-        Bits(C2_entry, k).ToBytes(C1_entry_buf);
-        final_file_writer_1 +=
-        		fwrite_at(plot_file, final_file_writer_1, C1_entry_buf, Util::ByteAlign(k) / 8);
+    	C1_table.resize(C1_table.size() + C1_entry_size);
+        Bits(C2_entry, k).ToBytes(C1_table.data() + C1_table.size() - C1_entry_size);
     }
-    Bits(0, Util::ByteAlign(k)).ToBytes(C1_entry_buf);
-    final_file_writer_1 +=
-    		fwrite_at(plot_file, final_file_writer_1, C1_entry_buf, Util::ByteAlign(k) / 8);
+    C1_table.resize(C1_table.size() + C1_entry_size);
+    
+    plot_file->write_at(begin_byte_C1, C1_table.data(), C1_table.size());
     
     std::cout << "[P4] Finished writing C2 table" << std::endl;
-
-    final_file_writer_1 = header_size - 8 * 3;
+    
+    if(C3_spill) {
+    	C3_spill->close();
+    	append_file(plot_file, begin_byte_C3, C3_spill->get_file_name());
+    	std::remove(C3_spill->get_file_name().c_str());
+    }
+    
+    uint64_t final_file_writer_1 = header_size - 8 * 3;
     uint8_t table_pointer_bytes[8] = {};
 
     // Writes the pointers to the start of the tables, for proving
     for (int i = 8; i <= 10; i++) {
         Util::IntToEightBytes(table_pointer_bytes, final_table_begin_pointers[i]);
         final_file_writer_1 +=
-        		fwrite_at(plot_file, final_file_writer_1, table_pointer_bytes, 8);
+        		plot_file->write_at(final_file_writer_1, table_pointer_bytes, 8);
     }
     return end_byte;
 }
@@ -250,15 +269,14 @@ void compute(	const phase3::output_t& input, output_t& out,
 {
 	const auto total_begin = get_wall_time_micros();
 	
-	FILE* plot_file = fopen(input.plot_file_name.c_str(), "rb+");
+	auto plot_file = input.plot_file;
 	if(!plot_file) {
-		throw std::runtime_error("fopen() failed");
+		plot_file = std::make_shared<PlotFile>(input.plot_file_name, false);
 	}
-	
-	out.plot_size = compute(plot_file, input.params.k, input.header_size, input.sort_7.get(),
-							num_threads, input.final_pointer_7, input.num_written_7);
-	
-	fclose(plot_file);
+	out.plot_size = compute(plot_file.get(), input.params.k, input.header_size, input.sort_7.get(),
+							num_threads, input.final_pointer_7, input.num_written_7,
+							tmp_dir_2 + plot_name + ".p4.c3.tmp");
+	plot_file->close();
 	
 	out.params = input.params;
 	out.plot_file_name = plot_dir + plot_name + ".plot";
@@ -24,6 +24,31 @@ extern size_t g_read_chunk_size;
  */
 extern size_t g_write_chunk_size;
 
+/*
+ * Pin ThreadPool workers round robin to NUMA nodes.
+ * default = false
+ */
+extern bool g_numa_spread;
+
+/*
+ * Back large buffers with huge pages, see hugepage.h
+ * default = false
+ */
+extern bool g_huge_pages;
+
+/*
+ * Store temporary files bit-packed (if supported by the entry type),
+ * see bucket_codec in DiskSort.h and packed_codec in bitpack.h
+ * default = false
+ */
+extern bool g_bit_pack;
+
+/*
+ * Memory budget in bytes, limits DiskSort read-ahead and automatic bucket count.
+ * default = 0 = half of physical memory
+ */
+extern uint64_t g_memory_budget;
+
 namespace phase2 {
   extern int g_thread_multi;
 }
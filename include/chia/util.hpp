@@ -40,6 +40,8 @@ constexpr inline Int cdiv(Int a, int b) { return (a + b - 1) / b; }
 #include <processthreadsapi.h>
 #include "uint128_t.h"
 #else
+#include <unistd.h>
+
 // __uint__128_t is only available in 64 bit architectures and on certain
 // compilers.
 typedef __uint128_t uint128_t;
@@ -417,6 +419,27 @@ std::ifstream::pos_type get_file_size(const char* file_name)
 	return in.tellg(); 
 }
 
+// Returns physical memory in bytes, 0 if unknown
+inline
+uint64_t get_total_memory()
+{
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	if(GlobalMemoryStatusEx(&status)) {
+		return status.ullTotalPhys;
+	}
+	return 0;
+#else
+	const long num_pages = ::sysconf(_SC_PHYS_PAGES);
+	const long page_size = ::sysconf(_SC_PAGESIZE);
+	if(num_pages > 0 && page_size > 0) {
+		return uint64_t(num_pages) * page_size;
+	}
+	return 0;
+#endif
+}
+
 inline
 void fseek_set(FILE* file, uint64_t offset) {
 	if(fseek(file, offset, SEEK_SET)) {
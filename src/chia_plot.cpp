@@ -11,6 +11,8 @@
 #include <chia/phase4.hpp>
 #include <chia/util.hpp>
 #include <chia/copy.h>
+#include <chia/CopyScheduler.h>
+#include <chia/numa.h>
 
 #include <bls.hpp>
 #include <sodium.h>
@@ -91,17 +93,26 @@ phase4::output_t create_plot(	const int k,
 								const vector<uint8_t>& farmer_key_bytes,
 								const std::string& tmp_dir,
 								const std::string& tmp_dir_2,
-								const std::string& plot_dir)
+								const std::string& plot_dir,
+								const bool stream = false)
 {
 	const auto total_begin = get_wall_time_micros();
 	const bool have_puzzle = !puzzle_hash_bytes.empty();
 	
 	std::cout << "Process ID: " << GETPID() << std::endl;
 	std::cout << "Number of Threads: " << num_threads << std::endl;
-	std::cout << "Number of Buckets P1:    2^" << log_num_buckets
-			<< " (" << (1 << log_num_buckets) << ")" << std::endl;
-	std::cout << "Number of Buckets P3+P4: 2^" << log_num_buckets_3
-			<< " (" << (1 << log_num_buckets_3) << ")" << std::endl;
+	if(log_num_buckets) {
+		std::cout << "Number of Buckets P1:    2^" << log_num_buckets
+				<< " (" << (1 << log_num_buckets) << ")" << std::endl;
+	} else {
+		std::cout << "Number of Buckets P1:    auto" << std::endl;
+	}
+	if(log_num_buckets_3) {
+		std::cout << "Number of Buckets P3+P4: 2^" << log_num_buckets_3
+				<< " (" << (1 << log_num_buckets_3) << ")" << std::endl;
+	} else {
+		std::cout << "Number of Buckets P3+P4: auto" << std::endl;
+	}
 	
 	bls::G1Element pool_key;
 	bls::G1Element farmer_key;
@@ -209,7 +220,7 @@ phase4::output_t create_plot(	const int k,
 	phase2::compute(out_1, out_2, num_threads, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2);
 	
 	phase3::output_t out_3;
-	phase3::compute(out_2, out_3, num_threads, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2, plot_dir);
+	phase3::compute(out_2, out_3, num_threads, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2, plot_dir, stream);
 	
 	phase4::output_t out_4;
 	phase4::compute(out_3, out_4, num_threads, log_num_buckets_3, plot_name, tmp_dir, tmp_dir_2, plot_dir);
@@ -246,6 +257,7 @@ int main(int argc, char** argv)
 	std::string tmp_dir;
 	std::string tmp_dir2;
 	std::string final_dir;
+	std::vector<std::string> final_dirs;
 	std::string stage_dir;
 	int k = 32;
 	int port = 8444;			// 8444 = chia, 9699 = chives
@@ -253,9 +265,15 @@ int main(int argc, char** argv)
 	int num_threads = 4;
 	int num_buckets = 256;
 	int num_buckets_3 = 0;
+	int num_copies = 1;
+	double copy_limit = 0;
+	double memory_gib = 0;
+	bool copy_adaptive = false;
 	bool waitforcopy = false;
 	bool tmptoggle = false;
 	bool directout = false;
+	bool stream = false;
+	int numa_node = -1;
 	bool make_unique = false;
 	
 	options.allow_unrecognised_options().add_options()(
@@ -264,20 +282,29 @@ int main(int argc, char** argv)
 		"i, id", "32-byte fixed id for the plot, for debugging", cxxopts::value<std::string>(plot_id_str))(
 		"n, count", "Number of plots to create (default = 1, -1 = infinite)", cxxopts::value<int>(num_plots))(
 		"r, threads", "Number of threads (default = 4)", cxxopts::value<int>(num_threads))(
-		"u, buckets", "Number of buckets (default = 256)", cxxopts::value<int>(num_buckets))(
+		"u, buckets", "Number of buckets (default = 256, 0 = auto)", cxxopts::value<int>(num_buckets))(
 		"v, buckets3", "Number of buckets for phase 3+4 (default = buckets)", cxxopts::value<int>(num_buckets_3))(
 		"t, tmpdir", "Temporary directory, needs ~220 GiB (default = $PWD)", cxxopts::value<std::string>(tmp_dir))(
 		"2, tmpdir2", "Temporary directory 2, needs ~110 GiB [RAM] (default = <tmpdir>)", cxxopts::value<std::string>(tmp_dir2))(
-		"d, finaldir", "Final directory to copy plot in parallel (default = <tmpdir>)", cxxopts::value<std::string>(final_dir))(
+		"d, finaldir", "Final directory to copy plot in parallel, can be repeated (default = <tmpdir>)", cxxopts::value<std::vector<std::string>>(final_dirs))(
 		"s, stagedir", "Stage directory to write plot file (default = <tmpdir>)", cxxopts::value<std::string>(stage_dir))(
 		"w, waitforcopy", "Wait for copy to start next plot", cxxopts::value<bool>(waitforcopy))(
+		"copies", "Max number of parallel copies per finaldir (default = 1)", cxxopts::value<int>(num_copies))(
+		"copy-limit", "Bandwidth limit for final copies in MB/s (default = 0 = unlimited)", cxxopts::value<double>(copy_limit))(
+		"copy-adaptive", "Slow down final copies while tmpdir is busy (default = false)", cxxopts::value<bool>(copy_adaptive))(
 		"p, poolkey", "Pool Public Key (48 bytes)", cxxopts::value<std::string>(pool_key_str))(
 		"c, contract", "Pool Contract Address (62 chars)", cxxopts::value<std::string>(contract_addr_str))(
 		"f, farmerkey", "Farmer Public Key (48 bytes)", cxxopts::value<std::string>(farmer_key_str))(
 		"G, tmptoggle", "Alternate tmpdir/tmpdir2 (default = false)", cxxopts::value<bool>(tmptoggle))(
 		"D, directout", "Create plot directly in finaldir (default = false)", cxxopts::value<bool>(directout))(
+		"stream", "Write plot sequentially to finaldir, implies directout (default = false)", cxxopts::value<bool>(stream))(
 		"Z, unique", "Make unique plot (default = false)", cxxopts::value<bool>(make_unique))(
 		"K, rmulti2", "Thread multiplier for P2 (default = 1)", cxxopts::value<int>(phase2::g_thread_multi))(
+		"memory", "Memory budget in GiB, for read-ahead and auto buckets (default = 0 = half of RAM)", cxxopts::value<double>(memory_gib))(
+		"pack", "Store temporary files bit-packed, less writes but more CPU (default = false)", cxxopts::value<bool>(g_bit_pack))(
+		"hugepages", "Use huge pages for large buffers (default = false)", cxxopts::value<bool>(g_huge_pages))(
+		"numa", "Spread worker threads across NUMA nodes (default = false)", cxxopts::value<bool>(g_numa_spread))(
+		"numa-node", "Bind to NUMA node, CPU and memory (default = -1 = off)", cxxopts::value<int>(numa_node))(
 		"version", "Print version")(
 		"help", "Print help");
 	
@@ -318,9 +345,10 @@ int main(int argc, char** argv)
 	if(tmp_dir2.empty()) {
 		tmp_dir2 = tmp_dir;
 	}
-	if(final_dir.empty()) {
-		final_dir = tmp_dir;
+	if(final_dirs.empty()) {
+		final_dirs.push_back(tmp_dir);
 	}
+	final_dir = final_dirs[0];
 	if(!stage_dir.empty() && tmptoggle) {
 		std::cout << "Stagedir and tmptoggle are mutually exclusive options." << std::endl;
 		return -2;
@@ -388,19 +416,50 @@ int main(int argc, char** argv)
 		std::cout << "Invalid tmpdir2: " << tmp_dir2 << " (needs trailing '/' or '\\')" << std::endl;
 		return -2;
 	}
-	if(!final_dir.empty() && final_dir.find_last_of("/\\") != final_dir.size() - 1) {
-		std::cout << "Invalid finaldir: " << final_dir << " (needs trailing '/' or '\\')" << std::endl;
+	for(const auto& dir : final_dirs) {
+		if(dir.empty() || dir.find_last_of("/\\") != dir.size() - 1) {
+			std::cout << "Invalid finaldir: " << dir << " (needs trailing '/' or '\\')" << std::endl;
+			return -2;
+		}
+	}
+	if(stream) {
+		directout = true;
+	}
+	if(final_dirs.size() > 1 && (directout || tmptoggle)) {
+		std::cout << "Multiple finaldirs cannot be used with directout or tmptoggle." << std::endl;
+		return -2;
+	}
+	if(copy_limit < 0) {
+		std::cout << "Invalid copy-limit parameter: " << copy_limit << std::endl;
+		return -2;
+	}
+	if(memory_gib < 0) {
+		std::cout << "Invalid memory parameter: " << memory_gib << std::endl;
+		return -2;
+	}
+	g_memory_budget = memory_gib * 1024 * 1024 * 1024;
+	
+	if(numa_node >= 0 && g_numa_spread) {
+		std::cout << "numa and numa-node are mutually exclusive options." << std::endl;
+		return -2;
+	}
+	if(numa_node >= 0 && !numa::bind_node(numa_node)) {
+		std::cout << "Failed to bind to NUMA node " << numa_node << " (found " << numa::get_num_nodes() << ")" << std::endl;
+		return -2;
+	}
+	if(num_copies < 1) {
+		std::cout << "Invalid copies parameter: " << num_copies << std::endl;
 		return -2;
 	}
 	if(num_threads < 1 || num_threads > 1024) {
 		std::cout << "Invalid threads parameter: " << num_threads << " (supported: [1..1024])" << std::endl;
 		return -2;
 	}
-	if(log_num_buckets < 4 || log_num_buckets > 16) {
+	if(log_num_buckets && (log_num_buckets < 4 || log_num_buckets > 16)) {
 		std::cout << "Invalid buckets parameter -u: 2^" << log_num_buckets << " (supported: 2^[4..16])" << std::endl;
 		return -2;
 	}
-	if (log_num_buckets_3 < 4 || log_num_buckets_3 > 16) {
+	if (log_num_buckets_3 && (log_num_buckets_3 < 4 || log_num_buckets_3 > 16)) {
 		std::cout << "Invalid buckets parameter -v: 2^" << log_num_buckets_3 << " (supported: 2^[4..16])" << std::endl;
 		return -2;
 	}
@@ -424,13 +483,13 @@ int main(int argc, char** argv)
 			return -2;
 		}
 	}
-	{
-		const std::string path = final_dir + ".chia_plot_final";
+	for(const auto& dir : final_dirs) {
+		const std::string path = dir + ".chia_plot_final";
 		if(auto file = fopen(path.c_str(), "wb")) {
 			fclose(file);
 			remove(path.c_str());
 		} else {
-			std::cout << "Failed to write to finaldir directory: '" << final_dir << "'" << std::endl;
+			std::cout << "Failed to write to finaldir directory: '" << dir << "'" << std::endl;
 			return -2;
 		}
 	}
@@ -444,7 +503,9 @@ int main(int argc, char** argv)
 			return -2;
 		}
 	}
-	const int num_files_max = (1 << std::max(log_num_buckets, log_num_buckets_3)) + 2 * num_threads + 32;
+	// auto buckets use at most 2^10, splitting an oversized bucket opens up to 2^8 more
+	const int num_files_max = (1 << std::max({log_num_buckets ? log_num_buckets : 10,
+			log_num_buckets_3 ? log_num_buckets_3 : 10})) + (1 << 8) + 2 * num_threads + 32;
 	
 #ifndef _WIN32
 	if(true) {
@@ -518,37 +579,37 @@ int main(int argc, char** argv)
 		std::cout << " (unique)";
 	}
 	std::cout << std::endl;
-	std::cout << "Final Directory: " << final_dir << std::endl;
+	for(const auto& dir : final_dirs) {
+		std::cout << "Final Directory: " << dir << std::endl;
+	}
+	if(copy_limit > 0) {
+		std::cout << "Copy Limit: " << copy_limit << " MB/s" << (copy_adaptive ? " (adaptive)" : "") << std::endl;
+	}
 	if (final_dir != stage_dir) {
 		std::cout << "Stage Directory: " << stage_dir << std::endl;
 	}
+	if(g_memory_budget) {
+		std::cout << "Memory Budget: " << memory_gib << " GiB" << std::endl;
+	}
+	if(numa_node >= 0) {
+		std::cout << "NUMA Node: " << numa_node << std::endl;
+	} else if(g_numa_spread) {
+		std::cout << "NUMA Nodes: " << numa::get_num_nodes() << std::endl;
+	}
 	if(num_plots >= 0) {
 		std::cout << "Number of Plots: " << num_plots << std::endl;
 	} else {
 		std::cout << "Number of Plots: infinite" << std::endl;
 	}
 	
-	Thread<std::pair<std::string, std::string>> copy_thread(
-		[](std::pair<std::string, std::string>& from_to) {
-			const auto total_begin = get_wall_time_micros();
-			while(true) {
-				try {
-					const auto bytes = final_copy(from_to.first, from_to.second);
-					
-					const auto time = (get_wall_time_micros() - total_begin) / 1e6;
-					if(time > 1) {
-						std::cout << "Copy to " << from_to.second << " finished, took " << time << " sec, "
-							<< ((bytes / time) / 1024 / 1024) << " MB/s avg." << std::endl;
-					} else {
-						std::cout << "Renamed final plot to " << from_to.second << std::endl;
-					}
-					break;
-				} catch(const std::exception& ex) {
-					std::cout << "Copy to " << from_to.second << " failed with: " << ex.what() << std::endl;
-					std::this_thread::sleep_for(std::chrono::minutes(5));
-				}
-			}
-		}, "final/copy");
+	RateLimiter copy_limiter(copy_limit * 1e6);
+	if(copy_adaptive) {
+		// the copies' own I/O on these devices is not counted
+		if(!copy_limiter.set_adaptive({tmp_dir, tmp_dir2}, {stage_dir}, final_dirs)) {
+			std::cout << "Cannot monitor tmpdir device, disabled copy-adaptive" << std::endl;
+		}
+	}
+	std::unique_ptr<CopyScheduler> copy_sched;
 	
 	for(int i = 0; i < num_plots || num_plots < 0; ++i)
 	{
@@ -560,16 +621,19 @@ int main(int argc, char** argv)
 				<< " (" << get_date_string_ex("%Y/%m/%d %H:%M:%S") << ")" << std::endl;
 		const auto out = create_plot(
 				k, port, plot_id, make_unique, num_threads, log_num_buckets, log_num_buckets_3,
-				pool_key, puzzle_hash, farmer_key, tmp_dir, tmp_dir2, directout ? final_dir : stage_dir);
+				pool_key, puzzle_hash, farmer_key, tmp_dir, tmp_dir2, directout ? final_dir : stage_dir, stream);
 		
-		if(final_dir != stage_dir)
+		if(final_dirs.size() > 1 || final_dir != stage_dir)
 		{
 			if(!directout) {
-				const auto dst_path = final_dir + out.params.plot_name + ".plot";
-				std::cout << "Started copy to " << dst_path << std::endl;
-				copy_thread.take_copy(std::make_pair(out.plot_file_name, dst_path));
+				if(!copy_sched) {
+					copy_sched = std::make_unique<CopyScheduler>(final_dirs, num_copies, &copy_limiter);
+				}
+				// with a single finaldir it might be toggled
+				const auto job = copy_sched->add(out.plot_file_name, out.params.plot_name + ".plot",
+						final_dirs.size() > 1 ? std::string() : final_dir);
 				if(waitforcopy) {
-					copy_thread.wait();
+					copy_sched->wait(job);
 				}
 			}
 		}
@@ -580,7 +644,9 @@ int main(int argc, char** argv)
 			tmp_dir.swap(tmp_dir2);
 		}
 	}
-	copy_thread.close();
+	if(copy_sched) {
+		copy_sched->close();
+	}
 	
 	return 0;
 }
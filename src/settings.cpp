@@ -10,6 +10,10 @@
 
 size_t g_read_chunk_size = 65536;
 size_t g_write_chunk_size = 4096;
+bool g_numa_spread = false;
+bool g_huge_pages = false;
+bool g_bit_pack = false;
+uint64_t g_memory_budget = 0;
 
 namespace phase2 {
   int g_thread_multi = 1;
@@ -16,9 +16,13 @@ int main(int argc, char** argv)
 		return -1;
 	}
 	
-	const auto bytes = final_copy(argv[1], argv[2]);
+	RateLimiter limiter(argc > 3 ? atof(argv[3]) * 1e6 : 0);
 	
-	std::cout << bytes << " bytes copied" <<  std::endl;
+	const auto time_begin = std::chrono::steady_clock::now();
+	const auto bytes = final_copy(argv[1], argv[2], &limiter);
+	const auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_begin).count();
+	
+	std::cout << bytes << " bytes copied, took " << time << " sec" <<  std::endl;
 	
 	return 0;
 }
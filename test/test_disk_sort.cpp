@@ -6,6 +6,7 @@
  */
 
 #include <chia/phase1.h>
+#include <chia/settings.h>
 #include <chia/DiskSort.hpp>
 
 #include <random>
@@ -23,11 +24,13 @@ int main(int argc, char** argv)
 //	const size_t num_buckets = size_t(1) << log_num_buckets;
 	const size_t num_threads = 4;
 	
+	typedef DiskSort<phase1::entry_1, phase1::get_y<phase1::entry_1>> DiskSort1;
+	
+	std::vector<uint64_t> first;		// x in sorted order, without splitting
+	
 	if(true) {
 		std::cout << "sizeof(phase1::entry_1) = " << sizeof(phase1::entry_1) << std::endl;
 		
-		typedef DiskSort<phase1::entry_1, phase1::get_y<phase1::entry_1>> DiskSort1;
-		
 		DiskSort1 sort(test_bits, log_num_buckets, "test");
 		
 		const auto add_begin = get_wall_time_micros();
@@ -50,9 +53,83 @@ int main(int argc, char** argv)
 			}, "test_output");
 		
 		const auto sort_begin = get_wall_time_micros();
+		sort.set_keep_files(true);
 		sort.read(&thread, num_threads);
+		sort.set_keep_files(false);
 		fclose(out);
 		std::cout << "sort() took " << (get_wall_time_micros() - sort_begin) / 1000. << " ms" << std::endl;
+		
+		// read twice via blocks(), the second time from the sorted spill
+		for(int pass = 0; pass < 2; ++pass) {
+			const auto begin = get_wall_time_micros();
+			uint64_t y_max = 0;
+			size_t count = 0;
+			for(const auto& block : sort.blocks(num_threads, true)) {
+				if(block.second != count) {
+					throw std::logic_error("block offset mismatch");
+				}
+				for(const auto& entry : block.first) {
+					if(entry.y < y_max) {
+						throw std::logic_error("entry.y < y_max");
+					}
+					y_max = entry.y;
+					if(pass == 0) {
+						first.push_back(entry.x);
+					} else if(first[count] != entry.x) {
+						throw std::logic_error("spill mismatch");
+					}
+					count++;
+				}
+			}
+			if(count != test_size) {
+				throw std::logic_error("blocks() count mismatch");
+			}
+			std::cout << "blocks() pass " << pass << " took " << (get_wall_time_micros() - begin) / 1000. << " ms" << std::endl;
+		}
+	}
+	
+	if(true) {
+		// same input again, with a memory budget small enough to split every bucket
+		generator.seed(0);
+		DiskSort1 sort(test_bits, log_num_buckets, "test_split");
+		
+		for(size_t i = 0; i < test_size; ++i) {
+			phase1::entry_1 entry = {};
+			entry.y = generator() % test_size;
+			entry.x = i;
+			sort.add(entry);
+		}
+		sort.finish();
+		
+		g_memory_budget = 1024 * 1024;
+		const auto begin = get_wall_time_micros();
+		size_t count = 0;
+		for(const auto& block : sort.blocks(num_threads)) {
+			if(block.second != count) {
+				throw std::logic_error("split: block offset mismatch");
+			}
+			for(const auto& entry : block.first) {
+				if(count >= first.size() || first[count] != entry.x) {
+					throw std::logic_error("split: order mismatch");
+				}
+				count++;
+			}
+		}
+		g_memory_budget = 0;
+		if(count != test_size) {
+			throw std::logic_error("split: count mismatch");
+		}
+		std::cout << "split sort took " << (get_wall_time_micros() - begin) / 1000. << " ms" << std::endl;
+		
+		for(size_t i = 0; i < (size_t(1) << log_num_buckets); ++i) {
+			for(size_t k = 0; k < 256; ++k) {
+				const std::string file_name = "test_split.sort_bucket_" + std::to_string(i) + ".tmp.part_" + std::to_string(k);
+				if(FILE* file = fopen(file_name.c_str(), "rb")) {
+					fclose(file);
+					throw std::logic_error("split: " + file_name + " left behind");
+				}
+			}
+		}
 	}
 	
 	if(false) {
@@ -0,0 +1,93 @@
+/*
+ * test_hugepage.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#include <chia/phase1.hpp>
+#include <chia/bitfield_index.hpp>
+
+#include <random>
+#include <iostream>
+
+using namespace phase1;
+
+
+/*
+ * Benchmark for phase 2 remap (bitfield_index lookups) and phase 1 match (FxMatcher),
+ * run once with and once without huge pages to compare.
+ */
+int main(int argc, char** argv)
+{
+	g_huge_pages = argc > 1 ? atoi(argv[1]) : 1;
+	const int log_size = argc > 2 ? atoi(argv[2]) : 32;
+	const uint64_t num_iter = argc > 3 ? atoll(argv[3]) : 10000000;
+
+	std::cout << "Huge pages: " << (g_huge_pages ? "on" : "off") << std::endl;
+
+	std::mt19937_64 generator(1337);
+	{
+		bitfield bits(uint64_t(1) << log_size);
+		for(int64_t i = 0; i < bits.size(); ++i) {
+			if(generator() % 5) {
+				bits.set(i);
+			}
+		}
+		const auto time_begin = get_wall_time_micros();
+		bitfield_index index(bits);
+		const auto time_index = get_wall_time_micros();
+
+		uint64_t sum = 0;
+		for(uint64_t i = 0; i < num_iter; ++i) {
+			uint64_t pos = generator() % (bits.size() - 1024);
+			while(!bits.get(pos)) {
+				pos++;
+			}
+			uint64_t next = pos + 1 + generator() % 256;
+			while(!bits.get(next)) {
+				next++;
+			}
+			const auto res = index.lookup(pos, next - pos);
+			sum += res.first + res.second;
+		}
+		std::cout << "bitfield_index: build took " << (time_index - time_begin) / 1e6 << " sec, "
+				<< num_iter << " lookups took " << (get_wall_time_micros() - time_index) / 1e6 << " sec"
+				<< " (" << sum % 1000 << ")" << std::endl;
+	}
+	{
+		initialize();
+
+		std::vector<bucket_t<entry_1>> buckets(4096);
+		for(size_t i = 0; i < buckets.size(); ++i) {
+			std::vector<entry_1> entries(200 + generator() % 70);
+			for(auto& entry : entries) {
+				entry.y = i * kBC + generator() % kBC;
+				entry.x = generator();
+			}
+			std::sort(entries.begin(), entries.end(),
+				[](const entry_1& lhs, const entry_1& rhs) -> bool {
+					return lhs.y < rhs.y;
+				});
+			for(const auto& entry : entries) {
+				buckets[i].push_back(entry);
+			}
+		}
+		auto& Fx = FxMatcher<entry_1>::get_local();
+		uint16_t idx_L[kBC];
+		uint16_t idx_R[kBC];
+
+		const auto time_begin = get_wall_time_micros();
+		uint64_t num_found = 0;
+		const uint64_t num_pairs = num_iter / 100;
+		for(uint64_t i = 0; i < num_pairs; ++i) {
+			const auto index = 1 + (i % (buckets.size() - 1));
+			const auto& L = buckets[index - 1];
+			const auto& R = buckets[index];
+			num_found += Fx.find_matches_ex(L.y.data(), L.size(), R.y.data(), R.size(), (index - 1) % 2, idx_L, idx_R);
+		}
+		std::cout << "FxMatcher: " << num_pairs << " bucket pairs took "
+				<< (get_wall_time_micros() - time_begin) / 1e6 << " sec, found " << num_found << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * test_park.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: mad
+ */
+
+#include <chia/phase3.hpp>
+
+#include <random>
+#include <iostream>
+
+using namespace phase3;
+
+
+int main(int argc, char** argv)
+{
+	const int k = argc > 1 ? atoi(argv[1]) : 32;
+	const int num_iter = argc > 2 ? atoi(argv[2]) : 100;
+
+	std::mt19937_64 generator(1337);
+
+	for(int iter = 0; iter < num_iter; ++iter)
+	{
+		const int table_index = 1 + iter % 6;
+		const size_t num_points = iter % 7 ? kEntriesPerPark : 1 + generator() % kEntriesPerPark;
+
+		// average delta of ~2^(k-3) like in the real tables
+		std::vector<uintlp_t> points(num_points);
+		points[0] = generator() & ((uint64_t(1) << (2 * k - 2)) - 1);
+		for(size_t i = 1; i < num_points; ++i) {
+			points[i] = points[i - 1] + (generator() & ((uint64_t(1) << (k - 2)) - 1));
+		}
+		std::vector<uint8_t> deltas(num_points - 1);
+		ParkBits stub_bits;
+		for(size_t i = 0; i < num_points - 1; ++i) {
+			const auto big_delta = points[i + 1] - points[i];
+			deltas[i] = big_delta >> (k - kStubMinusBits);
+			stub_bits.AppendValue(big_delta & ((1ull << (k - kStubMinusBits)) - 1), k - kStubMinusBits);
+		}
+		const auto park_size = CalculateParkSize(k, table_index);
+
+		std::vector<uint8_t> expected(park_size);
+		WritePark(points[0], deltas, stub_bits, k, table_index, expected.data(), expected.size());
+
+		std::vector<uint8_t> actual(park_size, 0xFF);
+		EncodePark(points.data(), points.size(), k, table_index, actual.data(), actual.size());
+
+		if(actual != expected) {
+			std::cout << "Park mismatch at iteration " << iter << " (table " << table_index
+					<< ", " << num_points << " points)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "All " << num_iter << " parks match" << std::endl;
+	return 0;
+}
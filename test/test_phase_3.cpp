@@ -45,21 +45,27 @@ int main(int argc, char** argv)
 		fclose(file);
 	}
 	
-	FILE* plot_file = fopen("test.plot.tmp", "wb");
-	if(!plot_file) {
-		throw std::runtime_error("fopen() failed");
-	}
-	const uint32_t header_size = WriteHeader(plot_file, k, id, nullptr, 0);
+	PlotFile plot_file("test.plot.tmp", true);
+	
+	const uint32_t header_size = WriteHeader(&plot_file, k, id, nullptr, 0);
 	
 	std::vector<uint64_t> final_pointers(8, 0);
 	final_pointers[1] = header_size;
 	
 	uint64_t num_written_final = 0;
 	
+	ThreadPool<std::vector<park_data_t>, size_t> park_threads(
+		[k, &plot_file](std::vector<park_data_t>& input, size_t&, size_t&) {
+			std::vector<park_out_t> out;
+			encode_parks(k, input, out);
+			plot_file.write_all(out);
+		}, nullptr, std::max(num_threads / 2, 1), "phase3/park");
+	
 	DiskTable<phase2::entry_1> L_table_1(table_1.file_name, table_1.num_entries);
 	
 	auto R_sort_in = std::make_shared<phase2::DiskSortT>(
 			k, log_num_buckets, "test.p2.t2", true);
+	R_sort_in->set_keep_sorted(true);		// next run reads without sorting
 	auto R_sort_lp = std::make_shared<DiskSortLP>(
 			2 * k - 1, log_num_buckets, "test.p3s1.t2");
 	
@@ -71,7 +77,7 @@ int main(int argc, char** argv)
 	
 	num_written_final += compute_stage2(
 			1, k, num_threads, R_sort_lp.get(), L_sort_np.get(),
-			plot_file, final_pointers[1], &final_pointers[2]);
+			&park_threads, final_pointers[1], &final_pointers[2]);
 	
 	for(int L_index = 2; L_index < 6; ++L_index)
 	{
@@ -90,7 +96,7 @@ int main(int argc, char** argv)
 		
 		num_written_final += compute_stage2(
 				L_index, k, num_threads, R_sort_lp.get(), L_sort_np.get(),
-				plot_file, final_pointers[L_index], &final_pointers[L_index + 1]);
+				&park_threads, final_pointers[L_index], &final_pointers[L_index + 1]);
 	}
 	
 	DiskTable<phase2::entry_7> R_table_7(table_7.file_name, table_7.num_entries);
@@ -106,16 +112,17 @@ int main(int argc, char** argv)
 	
 	const auto num_written_final_7 = compute_stage2(
 			6, k, num_threads, R_sort_lp.get(), L_sort_np.get(),
-			plot_file, final_pointers[6], &final_pointers[7]);
+			&park_threads, final_pointers[6], &final_pointers[7]);
 	num_written_final += num_written_final_7;
 	
-	fseek_set(plot_file, header_size - 10 * 8);
+	park_threads.close();
+	
 	for(size_t i = 1; i < final_pointers.size(); ++i) {
 		uint8_t tmp[8] = {};
 		Util::IntToEightBytes(tmp, final_pointers[i]);
-		fwrite_ex(plot_file, tmp, sizeof(tmp));
+		plot_file.write_at(header_size - 10 * 8 + (i - 1) * 8, tmp, sizeof(tmp));
 	}
-	fclose(plot_file);
+	plot_file.close();
 	{
 		std::ofstream out("test.p3.header_size");
 		out << header_size << std::endl;
@@ -20,10 +20,7 @@ int main(int argc, char** argv)
 	const int k = 32;
 	const auto total_begin = get_wall_time_micros();
 	
-	FILE* plot_file = fopen("test.plot.tmp", "rb+");
-	if(!plot_file) {
-		throw std::runtime_error("fopen() failed");
-	}
+	PlotFile plot_file("test.plot.tmp", false);
 	
 	int header_size = 0;
 	uint64_t final_pointer_7 = 0;
@@ -45,11 +42,12 @@ int main(int argc, char** argv)
 	std::cout << "[P4] num_written_final_7 = " << num_written_final_7 << std::endl;
 	
 	phase3::DiskSortNP L_sort_7(32, log_num_buckets, "test.p3s2.t7", true);
+	L_sort_7.set_keep_sorted(true);		// next run reads without sorting
 	
 	const uint64_t total_plot_size =
-			compute(plot_file, k, header_size, &L_sort_7, num_threads, final_pointer_7, num_written_final_7);
+			compute(&plot_file, k, header_size, &L_sort_7, num_threads, final_pointer_7, num_written_final_7);
 	
-	fclose(plot_file);
+	plot_file.close();
 	
 	std::cout << "Phase 4 took " << (get_wall_time_micros() - total_begin) / 1e6 << " sec"
 			", final plot size is " << total_plot_size << " bytes" << std::endl;